@@ -99,12 +99,42 @@ static ALWAYS_INLINE void arch_tlbi_vmalle1is() {
   arch_fence();
 }
 
+// invalidate the TLB entries of this CPU.
+static ALWAYS_INLINE void arch_tlbi_vmalle1() {
+  arch_fence();
+  asm volatile("tlbi vmalle1");
+  arch_fence();
+}
+
+// invalidate the entries for the page `va` tagged with `asid`, on all CPUs.
+static ALWAYS_INLINE void arch_tlbi_vae1is(u64 va, u64 asid) {
+  u64 x = (asid << 48) | ((va >> 12) & 0xFFFFFFFFFFF);
+  arch_fence();
+  asm volatile("tlbi vae1is, %[x]" : : [ x ] "r"(x));
+  arch_fence();
+}
+
+// invalidate the entries tagged with `asid`, on all CPUs.
+static ALWAYS_INLINE void arch_tlbi_aside1is(u64 asid) {
+  arch_fence();
+  asm volatile("tlbi aside1is, %[x]" : : [ x ] "r"(asid << 48));
+  arch_fence();
+}
+
 // set Translation Table Base Register 0 (EL1).
 static ALWAYS_INLINE void arch_set_ttbr0(u64 addr) {
   arch_fence();
   asm volatile("msr ttbr0_el1, %[x]" : : [ x ] "r"(addr));
   arch_tlbi_vmalle1is();
 }
+
+// set TTBR0 to the table `addr` with the ASID `asid`. Entries of other
+// ASIDs do not match, so nothing is invalidated.
+static ALWAYS_INLINE void arch_set_ttbr0_asid(u64 addr, u64 asid) {
+  arch_fence();
+  asm volatile("msr ttbr0_el1, %[x]" : : [ x ] "r"(addr | (asid << 48)));
+  arch_isb();
+}
 // get
 static inline WARN_RESULT u64 arch_get_ttbr0() {
   u64 result;
@@ -32,15 +32,25 @@
 #define PTE_USER (1 << 6)
 #define PTE_RO (1 << 7)
 #define PTE_RW (0 << 7)
+// not global: the entry is cached for the ASID of the current TTBR0 only.
+#define PTE_NG (1 << 11)
 
 #define PTE_KERNEL_DATA (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
-#define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_NG | PTE_PAGE)
+#define PTE_USER_BLOCK (PTE_USER | PTE_NORMAL | PTE_NG | PTE_BLOCK)
 
 #define N_PTE_PER_TABLE 512
 
+// a level-2 block maps as much as a whole level-3 table.
+#define HUGE_PAGE_ORDER 9
+#define HUGE_PAGE_SIZE (PAGE_SIZE << HUGE_PAGE_ORDER)
+
 #define PTE_HIGH_NX (1LL << 54)
 
+// software bit: a page that swap-in read ahead and that is not touched yet.
+#define PTE_SWAP_RA (1LL << 55)
+
 #define KSPACE_MASK 0xffff000000000000
 
 // convert kernel address into physical address.
@@ -41,3 +41,17 @@ static INLINE void bitmap_clear(BitmapCell* bitmap, usize index) {
     BITMAP_PARSE_INDEX(index, idx, offset);
     bitmap[idx] &= ~BIT(offset);
 }
+
+// the index of the first cleared bit in [from, size), or `size` if there is
+// none. Whole cells are skipped when they are full.
+static INLINE usize bitmap_find_zero(BitmapCell* bitmap, usize size, usize from) {
+    usize idx, offset;
+    BITMAP_PARSE_INDEX(from, idx, offset);
+    BitmapCell mask = ~(BIT(offset) - 1);
+    for (; idx < BITMAP_TO_NUM_CELLS(size); idx++, mask = ~0ull) {
+        BitmapCell cell = ~bitmap[idx] & mask;
+        if (cell != 0)
+            return MIN(idx * BITMAP_BITS_PER_CELL + __builtin_ctzll(cell), size);
+    }
+    return size;
+}
@@ -20,6 +20,10 @@ typedef struct buf {
     /* TODO: Lab7 driver. */
     ListNode node;
     Semaphore sl;
+    // when set, the request moves `count` consecutive blocks from or to these
+    // pages instead of `data`, as one multi-block transfer.
+    u8** pages;
+    u32 count;
 } buf;
 
 typedef struct BufQueue {
@@ -5,6 +5,7 @@
 #include "kernel/init.h"
 #include "kernel/printk.h"
 static ipc_ids msg_ids;
+static CacheNode* msg_queue_cache;
 void init_ipc() {
     init_spinlock(&msg_ids.lock);
     msg_ids.in_use = 0;
@@ -15,6 +16,10 @@ void init_ipc() {
 define_early_init(ipc_msg) {
     init_ipc();
 }
+define_init(msg_queue_cache) {
+    msg_queue_cache = kmem_cache_create("msg_queue", sizeof(msg_queue),
+                                        CACHE_LINE_SIZE, NULL);
+}
 static int ipc_addid(msg_queue* que) {
     int id = 0;
     for (; id < msg_ids.size; id++) {
@@ -33,11 +38,11 @@ static inline int ipc_buildin(int id, int seq) {
 }
 static int newque(int key) {
     int id;
-    msg_queue* que = (msg_queue*)kalloc(sizeof(msg_queue));
+    msg_queue* que = (msg_queue*)kmem_cache_alloc(msg_queue_cache);
     if (que == NULL)
         return ENOMEM;
     if ((id = ipc_addid(que)) < 0) {
-        kfree(que);
+        kmem_cache_free(msg_queue_cache, que);
         return ENOSEQ;
     }
     que->key = key;
@@ -78,34 +83,46 @@ int sys_msgget(int key, int msgflg) {
     _release_spinlock(&msg_ids.lock);
     return ret;
 }
+// segment pages are allocated this many at a time.
+#define MSG_BATCH PAGE_BATCH_SIZE
 static void free_msg(msg_msg* msg) {
-    msg_msgseg *mseg = msg->nxt, *nxtseg;
+    struct page_batch b = {0};
+    msg_msgseg* mseg = msg->nxt;
+    page_batch_add(&b, msg);
     while (mseg) {
-        nxtseg = mseg->nxt;
-        kfree_page((void*)mseg);
-        mseg = nxtseg;
+        page_batch_add(&b, mseg);
+        mseg = mseg->nxt;
     }
-    kfree_page(msg);
+    page_batch_flush(&b);
 }
 static msg_msg* load_msg(void* src, int len) {
     msg_msg* msg = (msg_msg*)kalloc_page();
     if (msg == NULL)
         return NULL;
-    memcpy(msg->data, src, MIN(MSG_MSGSZ, len));
-    len -= MIN(MSG_MSGSZ, len);
-    src += MIN(MSG_MSGSZ, len);
+    int sz = MIN(MSG_MSGSZ, len);
+    memcpy(msg->data, src, sz);
+    len -= sz;
+    src += sz;
     msg->nxt = NULL;
     msg_msgseg** lst = &msg->nxt;
     while (len > 0) {
-        msg_msgseg* mseg = (msg_msgseg*)kalloc_page();
-        if (mseg == NULL)
+        void* segs[MSG_BATCH];
+        int want = MIN(MSG_BATCH, (len + MSG_MSGSEGSZ - 1) / MSG_MSGSEGSZ);
+        int got = kalloc_page_batch(segs, want);
+        if (got < want) {
+            kfree_page_batch(segs, got);
             goto free_obj;
-        memcpy(mseg->data, src, MIN(MSG_MSGSEGSZ, len));
-        *lst = mseg;
-        mseg->nxt = NULL;
-        lst = &mseg->nxt;
-        len -= MIN(MSG_MSGSEGSZ, len);
-        src += MIN(MSG_MSGSEGSZ, len);
+        }
+        for (int i = 0; i < got; i++) {
+            msg_msgseg* mseg = (msg_msgseg*)segs[i];
+            sz = MIN(MSG_MSGSEGSZ, len);
+            memcpy(mseg->data, src, sz);
+            *lst = mseg;
+            mseg->nxt = NULL;
+            lst = &mseg->nxt;
+            len -= sz;
+            src += sz;
+        }
     }
     return msg;
 free_obj:
@@ -286,7 +303,7 @@ static void freeque(int id) {
             free_msg(container_of(node, msg_msg, node));
         }
         msg_ids.in_use--;
-        kfree((void*)msgq);
+        kmem_cache_free(msg_queue_cache, msgq);
     }
     _release_spinlock(&msg_ids.lock);
 }
@@ -1,8 +1,16 @@
 #include <common/sem.h>
+#include <kernel/init.h>
 #include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/sched.h>
 
+static CacheNode *wait_data_cache;
+
+define_init(wait_data_cache) {
+  wait_data_cache = kmem_cache_create("wait_data", sizeof(WaitData),
+                                      CACHE_LINE_SIZE, NULL);
+}
+
 void init_sem(Semaphore *sem, int val) {
   sem->val = val;
   init_spinlock(&sem->lock);
@@ -52,7 +60,7 @@ bool _wait_sem(Semaphore *sem, bool alertable) {
     release_spinlock(0, &sem->lock);
     return true;
   }
-  WaitData *wait = kalloc(sizeof(WaitData));
+  WaitData *wait = kmem_cache_alloc(wait_data_cache);
   wait->proc = thisproc();
   wait->up = false;
   _insert_into_list(&sem->sleeplist, &wait->slnode);
@@ -67,7 +75,7 @@ bool _wait_sem(Semaphore *sem, bool alertable) {
   }
   release_spinlock(0, &sem->lock);
   bool ret = wait->up;
-  kfree(wait);
+  kmem_cache_free(wait_data_cache, wait);
   return ret;
 }
 
@@ -135,6 +135,18 @@ void sd_init() {
   printk("mbr data: LBA:%d, sec_num:%d\n", LBA, sec_num);
 }
 
+#define PAGE_BLOCKS (PAGE_SIZE / BSIZE)
+
+// the number of blocks the request b moves.
+static u32 buf_blocks(struct buf *b) { return b->pages != NULL ? b->count : 1; }
+
+// the data of block i of the request b.
+static u32 *buf_block(struct buf *b, u32 i) {
+  if (b->pages == NULL)
+    return (u32 *)b->data;
+  return (u32 *)(b->pages[i / PAGE_BLOCKS] + i % PAGE_BLOCKS * BSIZE);
+}
+
 /* Start the request for b. Caller must hold sdlock. */
 static void sd_start(struct buf *b) {
   // Address is different depending on the card type.
@@ -143,6 +155,7 @@ static void sd_start(struct buf *b) {
   int bno =
       sdCard.type == SD_TYPE_2_HC ? (int)b->blockno : (int)b->blockno << 9;
   int write = b->flags & B_DIRTY;
+  u32 count = buf_blocks(b);
 
   // printk("- sd start: cpu %d, flag 0x%x, bno %d, write=%d\n", cpuid(),
   // b->flags, bno, write);
@@ -156,37 +169,59 @@ static void sd_start(struct buf *b) {
   arch_dsb_sy();
 
   // Work out the status, interrupt and command values for the transfer.
-  int cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
+  int cmd;
+  if (count > 1)
+    cmd = write ? IX_WRITE_MULTI : IX_READ_MULTI;
+  else
+    cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
   int resp;
-  *EMMC_BLKSIZECNT = 512;
+  *EMMC_BLKSIZECNT = count << 16 | 512;
 
   if ((resp = sdSendCommandA(cmd, bno))) {
     printk("* EMMC send command error.\n");
     PANIC();
   }
 
-  int done = 0;
-  u32 *intbuf = (u32 *)b->data;
-  if (!(((i64)b->data) & 0x03) == 0) {
-    printk("Only support word-aligned buffers. \n");
-    PANIC();
+  for (u32 i = 0; i < count; i++) {
+    if (((i64)buf_block(b, i)) & 0x03) {
+      printk("Only support word-aligned buffers. \n");
+      PANIC();
+    }
   }
 
   if (write) {
-    // Wait for ready interrupt for the next block.
-    if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
-      printk("* EMMC ERROR: Timeout waiting for ready to write\n");
-      PANIC();
-    }
-    if (*EMMC_INTERRUPT) {
-      printk("%d\n", *EMMC_INTERRUPT);
-      PANIC();
+    for (u32 i = 0; i < count; i++) {
+      // Wait for ready interrupt for the next block.
+      if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
+        printk("* EMMC ERROR: Timeout waiting for ready to write\n");
+        PANIC();
+      }
+      if (*EMMC_INTERRUPT) {
+        printk("%d\n", *EMMC_INTERRUPT);
+        PANIC();
+      }
+      int done = 0;
+      u32 *intbuf = buf_block(b, i);
+      while (done < 128)
+        *EMMC_DATA = intbuf[done++];
     }
-    while (done < 128)
-      *EMMC_DATA = intbuf[done++];
   }
 }
 
+// A multi-block transfer runs until it is stopped. The card stays busy until
+// the stop is done, and what that raises is cleared for the next request.
+// Caller must hold sdlock.
+static void sd_stop(struct buf *b) {
+  if (buf_blocks(b) <= 1)
+    return;
+  if (sdSendCommand(IX_STOP_TRANS)) {
+    printk("* EMMC ERROR: stop transmission failed\n");
+    PANIC();
+  }
+  sdWaitForData();
+  get_and_clear_EMMC_INTERRUPT();
+}
+
 /* The interrupt handler. Sync buf with disk.*/
 void sd_intr() {
   /*
@@ -217,24 +252,27 @@ void sd_intr() {
     bufqueue_pop(&bqueue);
     _acquire_spinlock(&sdlock);
     sdWaitForInterrupt(INT_DATA_DONE);
+    sd_stop(b);
     _release_spinlock(&sdlock);
     post_sem(&rw_done);
   } else if (!(b->flags & B_VALID)) {
     _acquire_spinlock(&sdlock);
-    if (sdWaitForInterrupt(INT_READ_RDY)) {
-      printk("* EMMC ERROR: Timeout waiting for ready to read\n");
-      PANIC();
-    }
-    if (*EMMC_INTERRUPT) {
-      printk("%d\n", *EMMC_INTERRUPT);
-      PANIC();
+    for (u32 i = 0; i < buf_blocks(b); i++) {
+      if (sdWaitForInterrupt(INT_READ_RDY)) {
+        printk("* EMMC ERROR: Timeout waiting for ready to read\n");
+        PANIC();
+      }
+      if (*EMMC_INTERRUPT) {
+        printk("%d\n", *EMMC_INTERRUPT);
+        PANIC();
+      }
+      u32 *intbuf = buf_block(b, i);
+      int done = 0;
+      while (done < 128)
+        intbuf[done++] = *EMMC_DATA;
     }
-    u32 *intbuf = (u32 *)b->data;
-    (void)intbuf;
-    int done = 0;
-    while (done < 128)
-      intbuf[done++] = *EMMC_DATA;
     sdWaitForInterrupt(INT_DATA_DONE);
+    sd_stop(b);
     _release_spinlock(&sdlock);
     b->flags = B_VALID;
     bufqueue_pop(&bqueue);
@@ -8,6 +8,7 @@ static void sd_read(usize block_no, u8 *buffer) {
   struct buf b;
   b.blockno = (u32)block_no + BLOCKNO_OFFSET;
   b.flags = 0;
+  b.pages = NULL;
   sdrw(&b);
   memcpy(buffer, b.data, BLOCK_SIZE);
 }
@@ -16,10 +17,29 @@ static void sd_write(usize block_no, u8 *buffer) {
   struct buf b;
   b.blockno = (u32)block_no + BLOCKNO_OFFSET;
   b.flags = B_DIRTY | B_VALID;
+  b.pages = NULL;
   memcpy(b.data, buffer, BLOCK_SIZE);
   sdrw(&b);
 }
 
+// pages go straight between memory and the card, one request per call.
+static void sd_rw_pages(usize block_no, u8 **pages, usize n, int flags) {
+  struct buf b;
+  b.blockno = (u32)block_no + BLOCKNO_OFFSET;
+  b.flags = flags;
+  b.pages = pages;
+  b.count = (u32)(n * BLOCKS_PER_PAGE);
+  sdrw(&b);
+}
+
+static void sd_read_pages(usize block_no, u8 **pages, usize n) {
+  sd_rw_pages(block_no, pages, n, 0);
+}
+
+static void sd_write_pages(usize block_no, u8 **pages, usize n) {
+  sd_rw_pages(block_no, pages, n, B_DIRTY | B_VALID);
+}
+
 static u8 sblock_data[BLOCK_SIZE];
 BlockDevice block_device;
 
@@ -33,6 +53,8 @@ void init_block_device() {
 
   block_device.read = sd_read;
   block_device.write = sd_write;
+  block_device.read_pages = sd_read_pages;
+  block_device.write_pages = sd_write_pages;
   const SuperBlock *sb = get_super_block();
   printk("num_blocks: %d\n", sb->num_blocks);
   printk("num_data_blocks: %d\n", sb->num_data_blocks);
@@ -41,6 +63,8 @@ void init_block_device() {
   printk("log_start: %d\n", sb->log_start);
   printk("inode_start: %d\n", sb->inode_start);
   printk("bitmap_start: %d\n", sb->bitmap_start);
+  printk("swap_start: %d\n", sb->swap_start);
+  printk("num_swap_blocks: %d\n", sb->num_swap_blocks);
 }
 
 const SuperBlock *get_super_block() { return (const SuperBlock *)sblock_data; }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <aarch64/mmu.h>
 #include <fs/defines.h>
 
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE)
+
 typedef struct {
     // read `BLOCK_SIZE` bytes in block at `block_no` to `buffer`.
     // caller must guarantee `buffer` is large enough.
@@ -10,6 +13,14 @@ typedef struct {
     // write `BLOCK_SIZE` bytes from `buffer` to block at `block_no`.
     // caller must guarantee `buffer` contains at least `BLOCK_SIZE` bytes.
     void (*write)(usize block_no, u8* buffer);
+
+    // read the `n * BLOCKS_PER_PAGE` blocks from `block_no` on into the pages
+    // `pages[0..n)`, as one request.
+    void (*read_pages)(usize block_no, u8** pages, usize n);
+
+    // write the pages `pages[0..n)` to the blocks from `block_no` on, as one
+    // request.
+    void (*write_pages)(usize block_no, u8** pages, usize n);
 } BlockDevice;
 
 extern BlockDevice block_device;
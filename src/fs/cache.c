@@ -10,6 +10,7 @@
 #include <common/bitmap.h>
 #include <common/string.h>
 #include <fs/cache.h>
+#include <fs/swap.h>
 #include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
@@ -21,7 +22,7 @@ static SpinLock lock;    // protects block cache.
 static ListNode head;    // the list of all allocated in-memory block.
 static LogHeader header; // in-memory copy of log header block.
 static Semaphore s1, s2, s3;
-static bool swap_valid[SWAP_END - SWAP_START];
+static CacheNode *block_cache;
 
 // hint: you may need some other variables. Just add them here.
 struct LOG {
@@ -51,8 +52,10 @@ static INLINE void read_header() {
 static INLINE void write_header() {
   device->write(sblock->log_start, (u8 *)&header);
 }
-// initialize a block struct.
-static void init_block(Block *block) {
+// initialize a block struct. Freed blocks stay initialized, except for the
+// fields `cache_acquire` sets anyway.
+static void init_block(void *p) {
+  Block *block = p;
   block->block_no = 0;
   init_list_node(&block->node);
   block->acquired = false;
@@ -108,9 +111,9 @@ static Block *cache_acquire(usize block_no) {
     }
   }
 
-  auto new_block = (Block *)kalloc(sizeof(Block));
-  init_block(new_block);
+  auto new_block = (Block *)kmem_cache_alloc(block_cache);
   new_block->block_no = block_no;
+  new_block->pinned = false;
   _insert_into_list(&head, &new_block->node);
   new_block->acquired = true;
   unalertable_wait_sem(&new_block->lock);
@@ -131,6 +134,47 @@ static void cache_release(Block *block) {
   post_sem(&block->lock);
 }
 
+// unacquired, unpinned blocks are clean copies of the disk and can be
+// dropped at any time.
+static u64 bcache_shrink_count() {
+  u64 cnt = 0;
+  _acquire_spinlock(&lock);
+  _for_in_list(p, &head) {
+    if (p == &head) {
+      continue;
+    }
+    auto bp = container_of(p, Block, node);
+    if (!bp->pinned && !bp->acquired) {
+      cnt++;
+    }
+  }
+  _release_spinlock(&lock);
+  return cnt;
+}
+
+// drop the least recently used blocks first.
+static u64 bcache_shrink_scan(u64 nr) {
+  u64 freed = 0;
+  _acquire_spinlock(&lock);
+  for (ListNode *p = head.prev; p != &head && freed < nr;) {
+    auto bp = container_of(p, Block, node);
+    p = p->prev;
+    if (!bp->pinned && !bp->acquired) {
+      _detach_from_list(&bp->node);
+      kmem_cache_free(block_cache, bp);
+      freed++;
+    }
+  }
+  _release_spinlock(&lock);
+  return freed;
+}
+
+static struct shrinker bcache_shrinker = {
+    .name = "bcache",
+    .count = bcache_shrink_count,
+    .scan = bcache_shrink_scan,
+};
+
 void install_trans() {
   for (usize tail = 0; tail < header.num_blocks; tail++) {
     auto from = cache_acquire(sblock->log_start + tail + 1);
@@ -161,6 +205,9 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
   // TODO
   init_spinlock(&lock);
   init_list_node(&head);
+  if (block_cache == NULL)
+    block_cache =
+        kmem_cache_create("block", sizeof(Block), CACHE_LINE_SIZE, init_block);
 
   init_spinlock(&log.lock);
   init_sem(&s1, 0);
@@ -171,9 +218,8 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
   log.outstanding = 0;
   recover_from_log();
 
-  for (auto i = SWAP_START; i < SWAP_END; i++) {
-    swap_valid[i] = false;
-  }
+  init_swap(_sblock, _device);
+  register_shrinker(&bcache_shrinker);
 }
 
 // see `cache.h`.
@@ -324,49 +370,6 @@ static void cache_free(OpContext *ctx, usize block_no) {
   cache_release(bp);
 }
 
-void release_8_blocks(u32 bno) {
-  for (usize i = bno - SWAP_START;
-       i < bno - SWAP_START + 8 && i < SWAP_END - SWAP_START; i++) {
-    swap_valid[i] = false;
-  }
-}
-
-u32 find_and_set_8_blocks() {
-
-  // TODO:在swap分区中找到8个连续的块，并返回第一个块的
-  // 块号
-  // OpContext ctx;
-
-  u32 left = 0, right = 0;
-  bool has_eight = FALSE;
-  while (right < SWAP_END - SWAP_START) {
-    if (swap_valid[right] == false) {
-      right++;
-      if (right - left == 8) {
-        has_eight = TRUE;
-        break;
-      }
-    } else {
-      left = right + 1;
-      right = right + 1;
-    }
-  }
-  if (has_eight) {
-    for (u32 i = left; i < right; i++) {
-      swap_valid[i] = true;
-    }
-    return SWAP_START + left;
-  }
-
-  printk("no continuous 8 blocks on disk");
-  for (auto i = 0; i < SWAP_END - SWAP_START; i++) {
-    printk("%d ", swap_valid[i]);
-  }
-  PANIC();
-  (void)swap_valid;
-  // return 0;
-}
-
 BlockCache bcache = {
     .get_num_cached_blocks = get_num_cached_blocks,
     .acquire = cache_acquire,
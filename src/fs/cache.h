@@ -107,5 +107,3 @@ extern BlockCache bcache;
 void init_bcache(const SuperBlock *sblock, const BlockDevice *device);
 usize BBLOCK(usize block_no, const SuperBlock *sb);
 void bzero(OpContext *ctx, u32 block_no);
-void release_8_blocks(u32 bno);
-u32 find_and_set_8_blocks();
@@ -32,14 +32,9 @@ typedef u16 InodeType;
 
 #define BIT_PER_BLOCK (BLOCK_SIZE * 8)
 
-#define SWAP_START 800
-#define SWAP_END 1000
-#define SWAP_BIT_START 100
-#define SWAP_BIT_END 125
-
 // disk layout:
 // [ MBR block | super block | log blocks | inode blocks | bitmap blocks | data
-// blocks ]
+// blocks | swap blocks ]
 //
 // `mkfs` generates the super block and builds an initial filesystem. The
 // super block describes the disk layout.
@@ -51,6 +46,8 @@ typedef struct {
   u32 log_start;      // the first block of logging area.
   u32 inode_start;    // the first block of inode area.
   u32 bitmap_start;   // the first block of bitmap area.
+  u32 swap_start;     // the first block of swap area.
+  u32 num_swap_blocks;
 } SuperBlock;
 
 // `type == INODE_INVALID` implies this inode is free.
@@ -81,4 +78,5 @@ typedef struct {
 } LogHeader;
 
 // mkfs only
-#define FSSIZE 1000 // Size of file system in blocks
\ No newline at end of file
+#define FSSIZE 1000 // Size of file system in blocks
+#define SWAPSIZE 16384 // Size of swap area in blocks, after the file system
\ No newline at end of file
@@ -19,6 +19,9 @@ static ListNode head;
 
 static const SuperBlock *sblock;
 static const BlockCache *cache;
+static CacheNode *inode_cache;
+
+static void init_inode(void *p);
 
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
@@ -35,12 +38,55 @@ static INLINE u32 *get_addrs(Block *block) {
   return ((IndirectBlock *)block->data)->addrs;
 }
 
+// in-memory inodes nobody refers to are kept only to be reused by
+// `inode_get`, and can be freed under memory pressure.
+static u64 inode_shrink_count() {
+  u64 cnt = 0;
+  _acquire_spinlock(&lock);
+  _for_in_list(p, &head) {
+    if (p == &head) {
+      continue;
+    }
+    if (container_of(p, Inode, node)->rc.count == 0) {
+      cnt++;
+    }
+  }
+  _release_spinlock(&lock);
+  return cnt;
+}
+
+static u64 inode_shrink_scan(u64 nr) {
+  u64 freed = 0;
+  _acquire_spinlock(&lock);
+  for (ListNode *p = head.next; p != &head && freed < nr;) {
+    auto ip = container_of(p, Inode, node);
+    p = p->next;
+    if (ip->rc.count == 0) {
+      _detach_from_list(&ip->node);
+      kmem_cache_free(inode_cache, ip);
+      freed++;
+    }
+  }
+  _release_spinlock(&lock);
+  return freed;
+}
+
+static struct shrinker inode_shrinker = {
+    .name = "inode",
+    .count = inode_shrink_count,
+    .scan = inode_shrink_scan,
+};
+
 // initialize inode tree.
 void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache) {
   init_spinlock(&lock);
   init_list_node(&head);
+  if (inode_cache == NULL)
+    inode_cache =
+        kmem_cache_create("inode", sizeof(Inode), CACHE_LINE_SIZE, init_inode);
   sblock = _sblock;
   cache = _cache;
+  register_shrinker(&inode_shrinker);
 
   if (ROOT_INODE_NO < sblock->num_inodes)
     inodes.root = inodes.get(ROOT_INODE_NO);
@@ -48,8 +94,9 @@ void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache) {
     printk("(warn) init_inodes: no root inode.\n");
 }
 
-// initialize in-memory inode.
-static void init_inode(Inode *inode) {
+// initialize in-memory inode. Freed inodes stay initialized.
+static void init_inode(void *p) {
+  Inode *inode = p;
   init_sleeplock(&inode->lock);
   init_rc(&inode->rc);
   init_list_node(&inode->node);
@@ -137,8 +184,7 @@ static Inode *inode_get(usize inode_no) {
   if (empty != NULL) {
     ip = container_of(empty, Inode, node);
   } else {
-    ip = (Inode *)kalloc(sizeof(Inode));
-    init_inode(ip);
+    ip = (Inode *)kmem_cache_alloc(inode_cache);
     _merge_list(&head, &ip->node);
   }
   ip->inode_no = inode_no;
@@ -206,7 +252,7 @@ static void inode_put(OpContext *ctx, Inode *inode) {
     _detach_from_list(&inode->node);
     _release_spinlock(&lock);
     _decrement_rc(&inode->rc);
-    kfree(inode);
+    kmem_cache_free(inode_cache, inode);
     return;
   }
   _decrement_rc(&inode->rc);
@@ -0,0 +1,96 @@
+#include <common/bitmap.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <fs/swap.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+
+// The swap area is a run of page-sized slots, one bit each in slot_map. Slots
+// are taken a cluster at a time: the next page swapped out goes to the slot
+// after the last one while the cluster lasts, so pages that are evicted
+// together, in address order, lie together on disk, and go out in one request.
+// Swap I/O goes to the device directly and never through the block cache.
+static const BlockDevice *device;
+static SpinLock slot_lock;
+static u32 swap_start;
+static usize num_slots;
+static usize num_free_slots;
+static BitmapCell *slot_map;
+static usize cluster_next; // the next slot of the current cluster
+
+void init_swap(const SuperBlock *sblock, const BlockDevice *_device) {
+  device = _device;
+  init_spinlock(&slot_lock);
+  swap_start = sblock->swap_start;
+  num_slots = sblock->num_swap_blocks / BLOCKS_PER_PAGE;
+  num_free_slots = num_slots;
+  cluster_next = 0;
+  if (slot_map != NULL)
+    kfree(slot_map);
+  slot_map = NULL;
+  usize size = BITMAP_TO_NUM_CELLS(num_slots) * sizeof(BitmapCell);
+  if (size > 0) {
+    slot_map = kalloc(size);
+    memset(slot_map, 0, size);
+  }
+}
+
+// the first slot of an empty cluster, or else the first free slot.
+static usize find_cluster() {
+  usize cells = BITMAP_TO_NUM_CELLS(num_slots);
+  for (usize i = 0; i < cells; i++) {
+    usize idx = (cluster_next / SWAP_CLUSTER + i) % cells;
+    if (slot_map[idx] == 0)
+      return idx * SWAP_CLUSTER;
+  }
+  return bitmap_find_zero(slot_map, num_slots, 0);
+}
+
+u32 alloc_swap_slot() {
+  _acquire_spinlock(&slot_lock);
+  if (num_free_slots == 0) {
+    printk("no free swap slot\n");
+    PANIC();
+  }
+  usize slot = cluster_next;
+  if (slot % SWAP_CLUSTER == 0 || slot >= num_slots ||
+      bitmap_get(slot_map, slot))
+    slot = find_cluster();
+  bitmap_set(slot_map, slot);
+  cluster_next = slot + 1;
+  num_free_slots--;
+  _release_spinlock(&slot_lock);
+  return swap_start + (u32)slot * BLOCKS_PER_PAGE;
+}
+
+void free_swap_slot(u32 bno) {
+  usize slot = (bno - swap_start) / BLOCKS_PER_PAGE;
+  _acquire_spinlock(&slot_lock);
+  ASSERT(slot < num_slots && bitmap_get(slot_map, slot));
+  bitmap_clear(slot_map, slot);
+  num_free_slots++;
+  _release_spinlock(&slot_lock);
+}
+
+usize free_swap_slots() { return num_free_slots; }
+
+// run `op` over the pages, one request per run of adjacent slots.
+static void swap_io(void (*op)(usize, u8 **, usize), const u32 *bno,
+                    u8 **pages, usize n) {
+  usize i = 0;
+  while (i < n) {
+    usize run = 1;
+    while (i + run < n && bno[i + run] == bno[i] + run * BLOCKS_PER_PAGE)
+      run++;
+    op(bno[i], pages + i, run);
+    i += run;
+  }
+}
+
+void swap_write_pages(const u32 *bno, u8 **pages, usize n) {
+  swap_io(device->write_pages, bno, pages, n);
+}
+
+void swap_read_pages(const u32 *bno, u8 **pages, usize n) {
+  swap_io(device->read_pages, bno, pages, n);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <fs/block_device.h>
+
+// a swap slot holds one page, BLOCKS_PER_PAGE blocks.
+// slots are handed out in clusters of this many, one cell of the slot bitmap.
+#define SWAP_CLUSTER 64
+
+// set up the swap area that `sblock` describes on `device`. All slots are free.
+void init_swap(const SuperBlock *sblock, const BlockDevice *device);
+
+// take a free slot and return its first block. Panics if there is none.
+WARN_RESULT u32 alloc_swap_slot();
+
+// free the slot that starts at block `bno`.
+void free_swap_slot(u32 bno);
+
+// the number of free slots.
+usize free_swap_slots();
+
+// write `pages[i]` to the slot that starts at block `bno[i]`, for i < n.
+void swap_write_pages(const u32 *bno, u8 **pages, usize n);
+
+// read the slot that starts at block `bno[i]` into `pages[i]`, for i < n.
+void swap_read_pages(const u32 *bno, u8 **pages, usize n);
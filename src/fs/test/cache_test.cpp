@@ -1,6 +1,7 @@
 #include "kernel/printk.h"
 extern "C" {
 #include <fs/cache.h>
+#include <fs/swap.h>
 }
 
 #include "assert.hpp"
@@ -469,6 +470,83 @@ void test_alloc_free() {
   }
 }
 
+// targets: `alloc_swap_slot`, `free_swap_slot`.
+
+void test_swap_slots() {
+  constexpr usize num_slots = 200;
+
+  SuperBlock sb = {};
+  sb.swap_start = 1000;
+  sb.num_swap_blocks = num_slots * BLOCKS_PER_PAGE;
+  init_swap(&sb, &device);
+  assert_eq(free_swap_slots(), num_slots);
+
+  std::vector<u32> bno;
+  for (usize i = 0; i < num_slots; i++) {
+    bno.push_back(alloc_swap_slot());
+  }
+  // slots taken one after another lie next to each other.
+  for (usize i = 0; i < num_slots; i++) {
+    assert_eq(bno[i], sb.swap_start + i * BLOCKS_PER_PAGE);
+  }
+  assert_eq(free_swap_slots(), 0);
+
+  free_swap_slot(bno[100]);
+  free_swap_slot(bno[3]);
+  assert_eq(free_swap_slots(), 2);
+  assert_eq(alloc_swap_slot(), bno[3]);
+  assert_eq(alloc_swap_slot(), bno[100]);
+
+  // an empty cluster is taken before the holes in a full one.
+  free_swap_slot(bno[5]);
+  for (usize i = 128; i < 192; i++) {
+    free_swap_slot(bno[i]);
+  }
+  assert_eq(alloc_swap_slot(), bno[128]);
+  assert_eq(alloc_swap_slot(), bno[129]);
+}
+
+// targets: `swap_write_pages`, `swap_read_pages`.
+
+void test_swap_io() {
+  constexpr usize num_slots = 4;
+
+  initialize_mock(1, 100);
+  sblock.swap_start = (u32)sblock.num_blocks;
+  sblock.num_swap_blocks = num_slots * BLOCKS_PER_PAGE;
+  sblock.num_blocks += sblock.num_swap_blocks;
+  mock.initialize(sblock);
+  init_swap(&sblock, &device);
+
+  std::vector<u32> bno;
+  for (usize i = 0; i < num_slots; i++) {
+    bno.push_back(alloc_swap_slot());
+  }
+
+  static u8 page[num_slots][PAGE_SIZE];
+  for (usize i = 0; i < num_slots; i++) {
+    for (usize j = 0; j < PAGE_SIZE; j++) {
+      page[i][j] = (u8)((i * 37 + j) & 0xff);
+    }
+  }
+
+  // slot 2 is left out, so the pages go out in two runs.
+  u32 victim_bno[] = {bno[0], bno[1], bno[3]};
+  u8 *victim_page[] = {page[0], page[1], page[3]};
+  swap_write_pages(victim_bno, victim_page, 3);
+  assert_eq(mock.write_count.load(), 3 * BLOCKS_PER_PAGE);
+
+  static u8 buf[3][PAGE_SIZE];
+  u8 *read_page[] = {buf[0], buf[1], buf[2]};
+  swap_read_pages(victim_bno, read_page, 3);
+  for (usize i = 0; i < 3; i++) {
+    for (usize j = 0; j < PAGE_SIZE; j++) {
+      assert_eq(buf[i][j], victim_page[i][j]);
+    }
+  }
+  assert_eq(mock.read_count.load(), 3 * BLOCKS_PER_PAGE);
+}
+
 } // namespace basic
 
 namespace concurrent {
@@ -903,6 +981,8 @@ int main() {
       {"replay", basic::test_replay},
       {"alloc", basic::test_alloc},
       {"alloc_free", basic::test_alloc_free},
+      {"swap_slots", basic::test_swap_slots},
+      {"swap_io", basic::test_swap_io},
 
       {"concurrent_acquire", concurrent::test_acquire},
       {"concurrent_sync", concurrent::test_sync},
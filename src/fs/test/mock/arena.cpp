@@ -18,4 +18,27 @@ void* kalloc(isize x) {
 void kfree(void* object) {
     free(object);
 }
+
+struct shrinker;
+void register_shrinker(struct shrinker*) {}
+
+struct CacheNode {
+    usize size, align;
+    void (*ctor)(void*);
+};
+
+CacheNode* kmem_cache_create(const char*, isize size, isize align, void (*ctor)(void*)) {
+    return new CacheNode{(usize)size, (usize)(align < 8 ? 8 : align), ctor};
+}
+
+void* kmem_cache_alloc(CacheNode* cache) {
+    void* p = aligned_alloc(cache->align, (cache->size + cache->align - 1) / cache->align * cache->align);
+    if (cache->ctor)
+        cache->ctor(p);
+    return p;
+}
+
+void kmem_cache_free(CacheNode*, void* object) {
+    free(object);
+}
 }
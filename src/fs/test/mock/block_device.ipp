@@ -14,6 +14,16 @@ static void stub_write(usize block_no, u8 *buffer) {
     mock.write(block_no, buffer);
 }
 
+static void stub_read_pages(usize block_no, u8 **pages, usize n) {
+    for (usize i = 0; i < n * BLOCKS_PER_PAGE; i++)
+        mock.read(block_no + i, pages[i / BLOCKS_PER_PAGE] + i % BLOCKS_PER_PAGE * BLOCK_SIZE);
+}
+
+static void stub_write_pages(usize block_no, u8 **pages, usize n) {
+    for (usize i = 0; i < n * BLOCKS_PER_PAGE; i++)
+        mock.write(block_no + i, pages[i / BLOCKS_PER_PAGE] + i % BLOCKS_PER_PAGE * BLOCK_SIZE);
+}
+
 static void initialize_mock(  //
     usize log_size,
     usize num_data_blocks,
@@ -31,6 +41,8 @@ static void initialize_mock(  //
 
     device.read = stub_read;
     device.write = stub_write;
+    device.read_pages = stub_read_pages;
+    device.write_pages = stub_write_pages;
 
     if (!image_path.empty())
         mock.load(image_path);
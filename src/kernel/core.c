@@ -3,6 +3,7 @@
 #include <fs/cache.h>
 #include <kernel/cpu.h>
 #include <kernel/init.h>
+#include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/sched.h>
 #include <test/test.h>
@@ -13,12 +14,15 @@ extern void sd_test();
 
 NO_RETURN void idle_entry() {
   // alloc_test();
+  // page_alloc_bench();
   // arch_stop_cpu();
   set_cpu_on();
   while (1) {
     yield();
     if (panic_flag)
       break;
+    // nothing else to run: prepare zeroed pages for page faults.
+    zero_idle_page();
     // if (cpuid() == 0) {
     arch_with_trap { /*arch_wfi();*/
     }
@@ -43,10 +47,29 @@ NO_RETURN void kernel_entry() {
   // container_test();
   // sd_test();
   // alloc_test();
+  // buddy_test();
+  // shrinker_test();
+  // kmem_cache_test();
+  // page_ref_test();
+  // zero_pool_test();
+  // batch_test();
   do_rest_init();
 
   pgfault_first_test();
   pgfault_second_test();
+  // cow_test();
+  // zero_fault_test();
+  // fault_around_test();
+  // huge_page_test();
+  // range_map_test();
+  // asid_test();
+  // clock_test();
+  // clock_block_test();
+  // reclaim_victim_test();
+  // swap_readahead_test();
+  // zswap_test();
+  // sparse_teardown_test();
+  // fork_teardown_test();
 
   while (1)
     yield();
@@ -5,6 +5,7 @@
 #include "kernel/proc.h"
 #include "kernel/pt.h"
 #include "kernel/sched.h"
+#include "kernel/syscall.h"
 #include <common/list.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
@@ -18,102 +19,472 @@ extern char end[];
 
 #define COLOUR_OFF 0
 #define CPU_NUM 4
-#define AC_LIMIT 10
+#define AC_LIMIT 32 // objects cached per CPU in an array cache
+#define AC_BATCH 16 // objects moved between an array cache and the slabs
 #define P2INDEX
+#define PAGE_MAG_SIZE 64  // pages cached by one CPU
+#define PAGE_MAG_BATCH 32 // pages moved between a magazine and the buddy at once
+#define ZERO_POOL_SIZE 256 // pre-zeroed pages kept for kalloc_zeroed_page
 
-static SpinLock mem_lock;
-static SpinLock mem_lock2;
-static SpinLock refcnt_lock;
-// static bool zero_init = true;
+// shared by every read-only mapping of zeroes. Its reference taken at init
+// is never dropped, so it is never freed.
 static void *zero_page;
-// struct page page_arr[TOTAL_PAGE];
-RefCount zero_page_cnt;
 
-RefCount alloc_page_cnt;
+// Per-CPU page magazine. kalloc_page/kfree_page only touch the magazine of
+// the current CPU; the buddy allocator is locked once per PAGE_MAG_BATCH pages.
+// `alloc_cnt` is the number of pages allocated minus the number of pages
+// freed on this CPU, so it can be negative. The other counters only feed
+// kmem_stat_dump.
+typedef struct PageMagazine {
+  int cnt;
+  isize alloc_cnt;
+  u64 allocs, frees; // single pages
+  u64 fills, drains; // trips to the buddy allocator
+  void *pages[PAGE_MAG_SIZE];
+} __attribute__((aligned(64))) PageMagazine;
 
-define_early_init(alloc_page_cnt) {
-  init_rc(&alloc_page_cnt);
-  init_spinlock(&mem_lock);
-  init_spinlock(&mem_lock2);
+static PageMagazine page_mag[CPU_NUM];
+
+// Physical pages are managed by a buddy allocator. A free block of 2^k pages
+// is aligned to 2^k pages, its first page stores the ListNode linking it into
+// free_area[k], and its `struct page` records PAGE_FREE and k. The
+// `struct page` array lives in the first pages after the kernel image.
+#define MAX_ORDER 11 // blocks of 2^0 .. 2^(MAX_ORDER - 1) pages
+
+static u64 mem_start, mem_end; // range managed by the buddy allocator
+static struct page *page_arr;
+// taken with traps masked: the timer may yield in the kernel, and the magazine
+// paths take it from per-CPU sections.
+static SpinLock buddy_lock;
+static ListNode free_area[MAX_ORDER];
+static usize free_cnt[MAX_ORDER];
+
+int page2index(void *p) { return ((u64)p - mem_start) / PAGE_SIZE; }
+
+struct page *virt_to_page(void *p) {
+  return &page_arr[page2index(p)];
 }
 
-int page2index(void *p) {
-  auto start = PAGE_BASE((u64)&end) + PAGE_SIZE;
-  return ((u64)p - start) / PAGE_SIZE;
+void *page_to_virt(struct page *page) {
+  return (void *)(mem_start + (u64)(page - page_arr) * PAGE_SIZE);
 }
 
-int total_page() {
-  return (P2K(PHYSTOP) - (PAGE_BASE((u64)&end) + PAGE_SIZE)) / PAGE_SIZE;
+int total_page() { return (mem_end - mem_start) / PAGE_SIZE; }
+
+static void set_page_block(u64 p, u8 flags, int order) {
+  auto page = virt_to_page((void *)p);
+  page->flags = flags;
+  page->order = order;
 }
 
-// All usable pages are added to the queue.
-// NOTE: You can use the page itself to store allocator data of it.
-// In this example, the fix-lengthed meta-data of the allocator are stored in
-// .bss (static QueueNode* pages),
-//  and the per-page allocator data are stored in the first sizeof(QueueNode)
-//  bytes of pages themselves.
-//
-// See API Reference for more information on given data structures.
-static QueueNode *pages;
+static void push_free_block(u64 p, int order) {
+  set_page_block(p, PAGE_FREE, order);
+  _insert_into_list(&free_area[order], (ListNode *)p);
+  free_cnt[order]++;
+}
+
+static void remove_free_block(u64 p, int order) {
+  set_page_block(p, 0, 0);
+  _detach_from_list((ListNode *)p);
+  free_cnt[order]--;
+}
+
+// caller must hold buddy_lock.
+static void *buddy_alloc(int order) {
+  int k = order;
+  while (k < MAX_ORDER && _empty_list(&free_area[k]))
+    k++;
+  if (k == MAX_ORDER)
+    return NULL;
+  u64 p = (u64)free_area[k].next;
+  remove_free_block(p, k);
+  // split the block and give back the upper halves.
+  while (k > order) {
+    k--;
+    push_free_block(p + (PAGE_SIZE << k), k);
+  }
+  set_page_block(p, 0, order);
+  return (void *)p;
+}
+
+// caller must hold buddy_lock.
+static void buddy_free(u64 p, int order) {
+  ASSERT(!(virt_to_page((void *)p)->flags & PAGE_FREE));
+  // coalesce with the buddy as long as the buddy is a free block of the same
+  // order.
+  while (order < MAX_ORDER - 1) {
+    u64 buddy = p ^ (PAGE_SIZE << order);
+    if (buddy < mem_start || buddy + (PAGE_SIZE << order) > mem_end ||
+        virt_to_page((void *)buddy)->flags != PAGE_FREE ||
+        virt_to_page((void *)buddy)->order != order)
+      break;
+    remove_free_block(buddy, order);
+    set_page_block(p, 0, 0);
+    p = MIN(p, buddy);
+    order++;
+  }
+  push_free_block(p, order);
+}
+
+// All usable pages are added to the buddy allocator, in blocks as large as
+// their alignment allows.
 define_early_init(pages) {
-  for (u64 p = PAGE_BASE((u64)&end) + PAGE_SIZE; p < P2K(PHYSTOP);
-       p += PAGE_SIZE) {
-    // init_rc(&page_arr[page2index((void *)p)].ref);
-    add_to_queue(&pages, (QueueNode *)p);
+  init_spinlock(&buddy_lock);
+  for (int i = 0; i < MAX_ORDER; i++)
+    init_list_node(&free_area[i]);
+  u64 start = PAGE_BASE((u64)&end) + PAGE_SIZE;
+  mem_end = P2K(PHYSTOP);
+  usize npages = (mem_end - start) / PAGE_SIZE;
+  page_arr = (struct page *)start;
+  mem_start = start + round_up(npages * sizeof(struct page), PAGE_SIZE);
+  memset(page_arr, 0, total_page() * sizeof(struct page));
+  for (u64 p = mem_start; p < mem_end;) {
+    int order = MAX_ORDER - 1;
+    while ((K2P(p) & ((PAGE_SIZE << order) - 1)) ||
+           p + (PAGE_SIZE << order) > mem_end)
+      order--;
+    push_free_block(p, order);
+    p += PAGE_SIZE << order;
   }
   printk("page list finish\n");
 }
 
 define_init(zero_page) {
-  // init_rc(&zero_page_cnt);
-  // zero_page = kalloc_page();
-  // memset(zero_page, 0, PAGE_SIZE);
-  // _increment_rc(&zero_page_cnt);
-  // _increment_rc(&alloc_page_cnt);
+  zero_page = kalloc_page();
+  memset(zero_page, 0, PAGE_SIZE);
 }
 
-// Allocate: fetch a page from the queue of usable pages.
+// move up to PAGE_MAG_BATCH pages from the buddy allocator into `mag`.
+static void fill_magazine(PageMagazine *mag) {
+  mag->fills++;
+  _acquire_spinlock(&buddy_lock);
+  while (mag->cnt < PAGE_MAG_BATCH) {
+    void *p = buddy_alloc(0);
+    if (p == NULL)
+      break;
+    mag->pages[mag->cnt++] = p;
+  }
+  _release_spinlock(&buddy_lock);
+}
+
+// give PAGE_MAG_BATCH pages of `mag` back to the buddy allocator.
+static void drain_magazine(PageMagazine *mag) {
+  mag->drains++;
+  _acquire_spinlock(&buddy_lock);
+  for (int i = 0; i < PAGE_MAG_BATCH; i++)
+    buddy_free((u64)mag->pages[--mag->cnt], 0);
+  _release_spinlock(&buddy_lock);
+}
+
+// per-CPU data is only protected by masking local interrupts.
+static void *mag_alloc_page() {
+  bool t = _arch_disable_trap();
+  auto mag = &page_mag[cpuid()];
+  if (mag->cnt == 0)
+    fill_magazine(mag);
+  void *p = NULL;
+  if (mag->cnt > 0) {
+    p = mag->pages[--mag->cnt];
+    mag->alloc_cnt++;
+    mag->allocs++;
+  }
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  return p;
+}
+
+static void mag_free_page(void *p) {
+  bool t = _arch_disable_trap();
+  auto mag = &page_mag[cpuid()];
+  if (mag->cnt == PAGE_MAG_SIZE)
+    drain_magazine(mag);
+  mag->pages[mag->cnt++] = p;
+  mag->alloc_cnt--;
+  mag->frees++;
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
+
+static void count_alloc_page(isize n) {
+  bool t = _arch_disable_trap();
+  page_mag[cpuid()].alloc_cnt += n;
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
+
+// Pages zeroed by idle CPUs. They are taken straight from the buddy
+// allocator and are not counted as allocated, so left_page_cnt does not
+// change when the pool is filled; kalloc_page falls back to them when
+// everything else is exhausted.
+static struct {
+  SpinLock lock;
+  int cnt;
+  u64 hits, misses;
+  void *pages[ZERO_POOL_SIZE];
+} zero_pool;
+
+define_early_init(zero_pool) { init_spinlock(&zero_pool.lock); }
+
+static void *zero_pool_pop() {
+  void *p = NULL;
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&zero_pool.lock);
+  if (zero_pool.cnt > 0) {
+    p = zero_pool.pages[--zero_pool.cnt];
+    zero_pool.hits++;
+  } else {
+    zero_pool.misses++;
+  }
+  _release_spinlock(&zero_pool.lock);
+  if (p != NULL)
+    count_alloc_page(1);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  return p;
+}
+
+// Zero one free page into the pool. Called from the idle loop, so it does a
+// bounded amount of work; returns false when there is nothing to do.
+bool zero_idle_page() {
+  if (__atomic_load_n(&zero_pool.cnt, __ATOMIC_RELAXED) >= ZERO_POOL_SIZE)
+    return false;
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&buddy_lock);
+  void *p = buddy_alloc(0);
+  _release_spinlock(&buddy_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  if (p == NULL)
+    return false;
+  memset(p, 0, PAGE_SIZE);
+  t = _arch_disable_trap();
+  _acquire_spinlock(&zero_pool.lock);
+  bool full = zero_pool.cnt == ZERO_POOL_SIZE;
+  if (!full)
+    zero_pool.pages[zero_pool.cnt++] = p;
+  _release_spinlock(&zero_pool.lock);
+  if (full) {
+    _acquire_spinlock(&buddy_lock);
+    buddy_free((u64)p, 0);
+    _release_spinlock(&buddy_lock);
+  }
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  return !full;
+}
+
+// Allocate: fetch a page from the magazine of this CPU. The page starts with
+// one reference.
 void *kalloc_page() {
-  _increment_rc(&alloc_page_cnt);
-  auto node = fetch_from_queue(&pages);
-  // _increment_rc(&page_arr[page2index(node)].ref);
+  auto node = mag_alloc_page();
+  if (node == NULL)
+    node = zero_pool_pop();
+  if (node != NULL) {
+    auto page = virt_to_page(node);
+    page->ref.count = 1;
+    page->owner = NULL;
+  }
   return node;
 }
 
-// Free: add the page to the queue of usable pages.
+// take another reference to a page from kalloc_page, so that it can be
+// shared.
+void get_page(void *p) { _increment_rc(&virt_to_page(p)->ref); }
+
+// Free: drop a reference, and add the page to the magazine of this CPU when
+// it was the last one.
 void kfree_page(void *p) {
-  if (p == zero_page) {
-    _decrement_rc(&zero_page_cnt);
-    if (zero_page_cnt.count == 0) {
-      _decrement_rc(&alloc_page_cnt);
-      add_to_queue(&pages, p);
-      zero_page = NULL;
+  auto page = virt_to_page(p);
+  if (_decrement_rc(&page->ref)) {
+    ASSERT(page->ref.count == 0);
+    mag_free_page(p);
+  }
+}
+
+isize page_ref_cnt(void *p) { return virt_to_page(p)->ref.count; }
+
+// like kalloc_page, but the page is filled with zeroes. The zeroing is
+// usually done ahead of time by an idle CPU.
+void *kalloc_zeroed_page() {
+  void *p = zero_pool_pop();
+  if (p != NULL) {
+    auto page = virt_to_page(p);
+    page->ref.count = 1;
+    page->owner = NULL;
+    return p;
+  }
+  p = kalloc_page();
+  if (p != NULL)
+    memset(p, 0, PAGE_SIZE);
+  return p;
+}
+
+// Allocate `n` pages into `pages`. The magazine of this CPU is used first and
+// the rest come from the buddy allocator under one lock. Returns the number
+// of pages allocated, which is less than `n` only when memory runs out.
+int kalloc_page_batch(void **pages, int n) {
+  int i = 0;
+  bool t = _arch_disable_trap();
+  auto mag = &page_mag[cpuid()];
+  while (i < n && mag->cnt > 0)
+    pages[i++] = mag->pages[--mag->cnt];
+  if (i < n) {
+    mag->fills++;
+    _acquire_spinlock(&buddy_lock);
+    while (i < n && (pages[i] = buddy_alloc(0)) != NULL)
+      i++;
+    _release_spinlock(&buddy_lock);
+  }
+  mag->alloc_cnt += i;
+  mag->allocs += i;
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  while (i < n && (pages[i] = zero_pool_pop()) != NULL)
+    i++;
+  for (int j = 0; j < i; j++) {
+    auto page = virt_to_page(pages[j]);
+    page->ref.count = 1;
+    page->owner = NULL;
+  }
+  return i;
+}
+
+// Drop a reference to each of the `n` pages. Freed pages go to the magazine of
+// this CPU, and the ones that do not fit to the buddy allocator under one
+// lock.
+void kfree_page_batch(void **pages, int n) {
+  bool locked = false;
+  bool t = _arch_disable_trap();
+  auto mag = &page_mag[cpuid()];
+  for (int i = 0; i < n; i++) {
+    auto page = virt_to_page(pages[i]);
+    if (!_decrement_rc(&page->ref))
+      continue;
+    ASSERT(page->ref.count == 0);
+    mag->alloc_cnt--;
+    mag->frees++;
+    if (mag->cnt < PAGE_MAG_SIZE) {
+      mag->pages[mag->cnt++] = pages[i];
+      continue;
     }
-  } else {
-    _decrement_rc(&alloc_page_cnt);
-    add_to_queue(&pages, p);
+    if (!locked) {
+      mag->drains++;
+      _acquire_spinlock(&buddy_lock);
+      locked = true;
+    }
+    buddy_free((u64)pages[i], 0);
   }
+  if (locked)
+    _release_spinlock(&buddy_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
+
+// start with `struct page_batch b = {0};` and flush once done.
+void page_batch_add(struct page_batch *b, void *p) {
+  if (b->cnt == PAGE_BATCH_SIZE)
+    page_batch_flush(b);
+  b->pages[b->cnt++] = p;
 }
 
+void page_batch_flush(struct page_batch *b) {
+  kfree_page_batch(b->pages, b->cnt);
+  b->cnt = 0;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Single pages go through the per-CPU magazine.
+void *kalloc_pages(int order) {
+  if (order == 0)
+    return kalloc_page();
+  ASSERT(order > 0 && order < MAX_ORDER);
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&buddy_lock);
+  auto p = buddy_alloc(order);
+  _release_spinlock(&buddy_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  if (p != NULL) {
+    auto page = virt_to_page(p);
+    page->ref.count = 1;
+    page->owner = NULL;
+    count_alloc_page(1 << order);
+  }
+  return p;
+}
+
+// Free 2^order pages allocated by kalloc_pages(order).
+void kfree_pages(void *p, int order) {
+  if (order == 0) {
+    kfree_page(p);
+    return;
+  }
+  auto page = virt_to_page(p);
+  ASSERT(page->order == order && !(page->flags & PAGE_SLAB));
+  if (!_decrement_rc(&page->ref))
+    return;
+  count_alloc_page(-(1 << order));
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&buddy_lock);
+  buddy_free((u64)p, order);
+  _release_spinlock(&buddy_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
+
+// Turn a block from kalloc_pages(order) into 2^order single pages with one
+// reference each, to be freed one by one with kfree_page.
+void split_pages(void *p, int order) {
+  auto page = virt_to_page(p);
+  ASSERT(page->order == order && page->ref.count == 1 &&
+         !(page->flags & PAGE_SLAB));
+  for (int i = 0; i < (1 << order); i++) {
+    page[i].ref.count = 1;
+    page[i].owner = NULL;
+    page[i].flags = 0;
+    page[i].order = 0;
+  }
+}
+
+// sum of the per-CPU counters. Other CPUs may be allocating at the same time,
+// so the result is only exact when the allocator is quiescent.
+isize alloc_page_cnt() {
+  isize cnt = 0;
+  for (int i = 0; i < CPU_NUM; i++)
+    cnt += __atomic_load_n(&page_mag[i].alloc_cnt, __ATOMIC_RELAXED);
+  return cnt;
+}
+
+// per-CPU object cache. It is only accessed by its own CPU with local
+// interrupts masked, so hits need no lock.
 typedef struct Array_cache {
   unsigned int avail;
   void *entry[AC_LIMIT];
-} Array_cache_t;
+  u64 allocs, frees;
+  u64 misses;  // allocations that had to refill
+  u64 flushes; // frees that had to flush
+} __attribute__((aligned(64))) Array_cache_t;
 
 // put the slab descripter in the head of slabs_partial,then set freelist and
 // avail.
-typedef struct CacheNode {
+struct CacheNode {
+  SpinLock lock; /* protects the slab lists */
+  const char *name;
+  void (*ctor)(void *); /* run once on every object of a new slab */
   unsigned int pgorder; /* order of pages per slab (2^n) */
   unsigned int num;     /* objects per slab */
   isize object_size;
+  unsigned int obj_offset; /* offset of the first object in a slab */
   unsigned int colour_off; /* colour offset */
   Array_cache_t array_cache[CPU_NUM];
   ListNode slabs_partial_head;
   ListNode slabs_full_head;
   ListNode slabs_free_head;
   ListNode cnode;
-} CacheNode;
+};
 
+// the slab descripter is at the beginning of the slab, followed by the
+// freelist and the objects.
 typedef struct SlabNode {
   int colour;
   unsigned int active;
@@ -122,7 +493,90 @@ typedef struct SlabNode {
   ListNode snode;
 } SlabNode;
 
-// first means a cache node's first slab, save cache data (slab descripter data)
+// kalloc serves requests from a fixed table of size classes: powers of two
+// with one intermediate class in between, so at most a third of an object is
+// wasted. Larger requests go to the page allocator.
+static const isize size_classes[] = {8,   16,  24,  32,   48,   64,
+                                     96,  128, 192, 256,  384,  512,
+                                     768, 1024, 1536, 2048};
+static const char *size_class_names[] = {
+    "kmalloc-8",    "kmalloc-16",   "kmalloc-24",  "kmalloc-32",
+    "kmalloc-48",   "kmalloc-64",   "kmalloc-96",  "kmalloc-128",
+    "kmalloc-192",  "kmalloc-256",  "kmalloc-384", "kmalloc-512",
+    "kmalloc-768",  "kmalloc-1024", "kmalloc-1536", "kmalloc-2048"};
+#define NR_SIZE_CLASSES (int)(sizeof(size_classes) / sizeof(size_classes[0]))
+#define MAX_CLASS_SIZE 2048
+#define SLAB_MAX_ORDER 3
+// size_index[(size + 7) / 8] is the class serving `size`.
+static u8 size_index[MAX_CLASS_SIZE / 8 + 1];
+static CacheNode kmem_cache_array[NR_SIZE_CLASSES];
+// the caches made by kmem_cache_create are allocated from cache_cache.
+static CacheNode cache_cache;
+// all caches, linked by cnode. Caches are never destroyed.
+static ListNode cache_chain;
+static SpinLock cache_chain_lock;
+
+static unsigned int slab_obj_offset(int num, isize align) {
+  return round_up(sizeof(SlabNode) + sizeof(int) * num, align);
+}
+
+// objects are `size` bytes rounded up to `align`, which must be a power of two
+// no smaller than 8.
+void init_cache_node(const char *name, isize size, isize align,
+                     void (*ctor)(void *), CacheNode *cache_node) {
+  size = round_up(size, align);
+  // use the smallest slab that wastes no more than 1/8 of its pages.
+  unsigned int order = 0;
+  usize bytes, num;
+  while (1) {
+    bytes = PAGE_SIZE << order;
+    num = (bytes - sizeof(SlabNode)) / (size + sizeof(int));
+    while (slab_obj_offset(num, align) + num * size > bytes)
+      num--;
+    if ((bytes - num * size) * 8 <= bytes || order == SLAB_MAX_ORDER)
+      break;
+    order++;
+  }
+  cache_node->name = name;
+  cache_node->ctor = ctor;
+  cache_node->pgorder = order;
+  cache_node->object_size = size;
+  cache_node->num = num;
+  cache_node->obj_offset = slab_obj_offset(num, align);
+  cache_node->colour_off = COLOUR_OFF;
+  init_spinlock(&cache_node->lock);
+  init_list_node(&cache_node->slabs_partial_head);
+  init_list_node(&cache_node->slabs_full_head);
+  init_list_node(&cache_node->slabs_free_head);
+  memset(cache_node->array_cache, 0, sizeof(cache_node->array_cache));
+  init_list_node(&cache_node->cnode);
+}
+
+static SpinLock shrinker_lock;
+static ListNode shrinker_head;
+static struct shrinker slab_shrinker;
+
+define_early_init(kmem_cache) {
+  for (int i = 0, c = 0; i <= MAX_CLASS_SIZE / 8; i++) {
+    while (size_classes[c] < i * 8)
+      c++;
+    size_index[i] = c;
+  }
+  init_list_node(&cache_chain);
+  init_spinlock(&cache_chain_lock);
+  for (int i = 0; i < NR_SIZE_CLASSES; i++) {
+    init_cache_node(size_class_names[i], size_classes[i], 8, NULL,
+                    &kmem_cache_array[i]);
+    _insert_into_list(&cache_chain, &kmem_cache_array[i].cnode);
+  }
+  init_cache_node("kmem_cache", sizeof(CacheNode), CACHE_LINE_SIZE, NULL,
+                  &cache_cache);
+  _insert_into_list(&cache_chain, &cache_cache.cnode);
+  init_spinlock(&shrinker_lock);
+  init_list_node(&shrinker_head);
+  register_shrinker(&slab_shrinker);
+}
+
 void init_slab_node(SlabNode *slab_node, int obj_num) {
   slab_node->active = 0;
   slab_node->colour = 0;
@@ -133,196 +587,489 @@ void init_slab_node(SlabNode *slab_node, int obj_num) {
   init_list_node(&slab_node->snode);
 }
 
+// every page of a slab is marked with PAGE_SLAB and the order of the slab, so
+// the slab of an object is found by aligning it down to the slab size.
+static SlabNode *new_slab(CacheNode *cache_node) {
+  auto slab_node = (SlabNode *)kalloc_pages(cache_node->pgorder);
+  if (slab_node == NULL)
+    return NULL;
+  for (int i = 0; i < 1 << cache_node->pgorder; i++) {
+    auto page = virt_to_page(slab_node) + i;
+    page->flags = PAGE_SLAB;
+    page->order = cache_node->pgorder;
+    page->owner = cache_node;
+  }
+  init_slab_node(slab_node, cache_node->num);
+  slab_node->owner_cache = cache_node;
+  if (cache_node->ctor) {
+    for (unsigned int i = 0; i < cache_node->num; i++)
+      cache_node->ctor((void *)((u64)slab_node + cache_node->obj_offset +
+                                i * cache_node->object_size));
+  }
+  return slab_node;
+}
+
+static SlabNode *obj_to_slab(void *obj) {
+  auto order = virt_to_page(obj)->order;
+  return (SlabNode *)((u64)obj & ~((PAGE_SIZE << order) - 1));
+}
+
 // must ensure the slab is not full
-void *alloc_obj(SlabNode *slab_node, isize size, int obj_num) {
-  auto ret = (void *)((u64)slab_node + sizeof(SlabNode) +
-                      (sizeof(int) * obj_num / 8 + 1) * 8 + slab_node->colour +
-                      (slab_node->freelist[slab_node->active++]) * size);
-  return ret;
+void *alloc_obj(SlabNode *slab_node, CacheNode *cache_node) {
+  return (void *)((u64)slab_node + cache_node->obj_offset + slab_node->colour +
+                  (slab_node->freelist[slab_node->active++]) *
+                      cache_node->object_size);
 }
 
-int get_obj_index(SlabNode *slab_node, isize size, int obj_num,
-                  void *obj_addr) {
-  return ((u64)obj_addr - (u64)slab_node - (sizeof(int) * obj_num / 8 + 1) * 8 -
-          slab_node->colour - sizeof(SlabNode)) /
-         size;
+int get_obj_index(SlabNode *slab_node, CacheNode *cache_node, void *obj_addr) {
+  return ((u64)obj_addr - (u64)slab_node - cache_node->obj_offset -
+          slab_node->colour) /
+         cache_node->object_size;
 }
 
-// head can be null
-void init_cache_node(isize size, CacheNode *cache_node, int num) {
-  cache_node->pgorder = 0;
-  cache_node->object_size = size;
-  cache_node->colour_off = COLOUR_OFF;
-  cache_node->num = num;
-  init_list_node(&cache_node->slabs_partial_head);
-  init_list_node(&cache_node->slabs_full_head);
-  init_list_node(&cache_node->slabs_free_head);
-  for (int i = 0; i < CPU_NUM; i++) {
-    cache_node->array_cache[i].avail = 0;
-    for (int j = 0; j < AC_LIMIT; j++) {
-      cache_node->array_cache[i].entry[j] = 0;
+// take one object from the slab lists, growing the cache if all slabs are
+// full.
+static void *cache_alloc_obj(CacheNode *cache_node) {
+  SlabNode *slab_node;
+  if (!_empty_list(&cache_node->slabs_partial_head)) {
+    slab_node = container_of(cache_node->slabs_partial_head.next,
+                             struct SlabNode, snode);
+  } else {
+    if (!_empty_list(&cache_node->slabs_free_head)) {
+      slab_node = container_of(cache_node->slabs_free_head.next,
+                               struct SlabNode, snode);
+      _detach_from_list(&slab_node->snode);
+    } else {
+      slab_node = new_slab(cache_node);
+      if (slab_node == NULL)
+        return NULL;
     }
+    _merge_list(&cache_node->slabs_partial_head, &slab_node->snode);
   }
-  init_list_node(&cache_node->cnode);
+  auto ret = alloc_obj(slab_node, cache_node);
+  if (slab_node->active >= cache_node->num) {
+    _detach_from_list(&slab_node->snode);
+    _merge_list(&cache_node->slabs_full_head, &slab_node->snode);
+  }
+  return ret;
 }
 
-static CacheNode *kmem_cache_array[2048];
+// give one object back to its slab.
+static void cache_free_obj(CacheNode *cache_node, void *obj) {
+  auto slab_node = obj_to_slab(obj);
+  bool was_full = slab_node->active == cache_node->num;
+  slab_node->freelist[--slab_node->active] =
+      get_obj_index(slab_node, cache_node, obj);
+  if (slab_node->active == 0) {
+    _detach_from_list(&slab_node->snode);
+    _merge_list(&cache_node->slabs_free_head, &slab_node->snode);
+  } else if (was_full) {
+    _detach_from_list(&slab_node->snode);
+    _merge_list(&cache_node->slabs_partial_head, &slab_node->snode);
+  }
+}
 
-// objects in the middle be freed
-void *kalloc(isize size) {
+static int size_to_order(isize size) {
+  int order = 0;
+  while ((PAGE_SIZE << order) < size)
+    order++;
+  return order;
+}
+
+// refill the empty array cache with up to AC_BATCH objects under one lock.
+static void cache_alloc_refill(Array_cache_t *ac, CacheNode *cache_node) {
   setup_checker(one);
-  acquire_spinlock(one, &mem_lock);
-  void *objp;
-  CacheNode *search_res = kmem_cache_array[size];
-  if (NULL == search_res) {
-    auto slab_node = (SlabNode *)(kalloc_page());
-    auto cache_node = (CacheNode *)(PAGE_BASE((u64)slab_node) + PAGE_SIZE -
-                                    sizeof(CacheNode));
-    kmem_cache_array[size] = cache_node;
-    auto num = (PAGE_SIZE - 3 * COLOUR_OFF - sizeof(SlabNode) - 8 -
-                sizeof(CacheNode)) /
-               (size + sizeof(int));
-    init_cache_node(size, cache_node, num);
-    init_slab_node(slab_node, num);
-    slab_node->owner_cache = cache_node;
-    _insert_into_list(&cache_node->slabs_partial_head, &slab_node->snode);
-    auto ret = alloc_obj(slab_node, size, num);
-    if (slab_node->active >= cache_node->num) {
-      _detach_from_list(&slab_node->snode);
-      _merge_list(&slab_node->snode, &cache_node->slabs_full_head);
-    }
-    release_spinlock(one, &mem_lock);
-    return ret;
+  acquire_spinlock(one, &cache_node->lock);
+  while (ac->avail < AC_BATCH) {
+    auto objp = cache_alloc_obj(cache_node);
+    if (objp == NULL)
+      break;
+    ac->entry[ac->avail++] = objp;
   }
+  release_spinlock(one, &cache_node->lock);
+}
 
-  auto kmem_cache = search_res;
+// give the AC_BATCH oldest objects of the full array cache back to their
+// slabs under one lock, keeping the recently freed (cache-hot) ones.
+void cache_flusharray(Array_cache_t *ac, CacheNode *cache_node) {
+  setup_checker(one);
+  acquire_spinlock(one, &cache_node->lock);
+  for (int i = 0; i < AC_BATCH; i++)
+    cache_free_obj(cache_node, ac->entry[i]);
+  release_spinlock(one, &cache_node->lock);
+  ac->avail -= AC_BATCH;
+  memmove(ac->entry, ac->entry + AC_BATCH, ac->avail * sizeof(void *));
+}
+
+static void *cache_alloc(CacheNode *kmem_cache) {
+  void *objp = NULL;
+  bool t = _arch_disable_trap();
   Array_cache_t *ac = &(kmem_cache->array_cache[cpuid()]);
+  if (ac->avail == 0) {
+    ac->misses++;
+    cache_alloc_refill(ac, kmem_cache);
+  }
   if (ac->avail > 0) {
     objp = ac->entry[--ac->avail];
-    release_spinlock(one, &mem_lock);
-    return objp;
-  }
-  // avail is zero,refill the entry from global
-  if (!_empty_list(&kmem_cache->slabs_partial_head)) {
-    auto slab_node = container_of(kmem_cache->slabs_partial_head.next,
-                                  struct SlabNode, snode);
-    auto ret = alloc_obj(slab_node, size, kmem_cache->num);
-    if (slab_node->active >= kmem_cache->num) {
-      _detach_from_list(&slab_node->snode);
-      _merge_list(&slab_node->snode, &kmem_cache->slabs_full_head);
-    }
-    release_spinlock(one, &mem_lock);
-    return ret;
+    ac->allocs++;
   }
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  return objp;
+}
 
-  if (!_empty_list(&kmem_cache->slabs_free_head)) {
-    auto slab_node =
-        container_of(kmem_cache->slabs_free_head.next, struct SlabNode, snode);
-    auto ret = alloc_obj(slab_node, size, kmem_cache->num);
-
-    _detach_from_list(&slab_node->snode);
+static void cache_free(CacheNode *kmem_cache, void *p) {
+  bool t = _arch_disable_trap();
+  Array_cache_t *ac = &(kmem_cache->array_cache[cpuid()]);
+  if (ac->avail == AC_LIMIT) {
+    ac->flushes++;
+    cache_flusharray(ac, kmem_cache);
+  }
+  ac->entry[ac->avail++] = p;
+  ac->frees++;
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
 
-    if (slab_node->active >= kmem_cache->num) {
-      _merge_list(&slab_node->snode, &kmem_cache->slabs_full_head);
-    } else {
-      _merge_list(&slab_node->snode, &kmem_cache->slabs_partial_head);
-    }
+void *kalloc(isize size) {
+  if (size > MAX_CLASS_SIZE)
+    return kalloc_pages(size_to_order(size));
+  return cache_alloc(&kmem_cache_array[size_index[(size + 7) / 8]]);
+}
 
-    release_spinlock(one, &mem_lock);
-    return ret;
+void kfree(void *p) {
+  auto page = virt_to_page(p);
+  if (!(page->flags & PAGE_SLAB)) {
+    // allocated by the page allocator
+    kfree_pages(p, page->order);
+    return;
   }
+  cache_free(obj_to_slab(p)->owner_cache, p);
+}
 
-  auto slab_node = (SlabNode *)kalloc_page();
-  init_slab_node(slab_node, kmem_cache->num);
-  slab_node->owner_cache = kmem_cache;
+CacheNode *kmem_cache_create(const char *name, isize size, isize align,
+                             void (*ctor)(void *)) {
+  align = MAX(align, 8);
+  ASSERT((align & (align - 1)) == 0 && align <= PAGE_SIZE);
+  ASSERT(round_up(size, align) <= (PAGE_SIZE << SLAB_MAX_ORDER) / 2);
+  CacheNode *cache_node = cache_alloc(&cache_cache);
+  if (cache_node == NULL)
+    return NULL;
+  init_cache_node(name, size, align, ctor, cache_node);
+  _acquire_spinlock(&cache_chain_lock);
+  _insert_into_list(&cache_chain, &cache_node->cnode);
+  _release_spinlock(&cache_chain_lock);
+  return cache_node;
+}
 
-  _insert_into_list(&kmem_cache->slabs_partial_head, &slab_node->snode);
-  auto ret = alloc_obj(slab_node, size, kmem_cache->num);
-  if (slab_node->active >= kmem_cache->num) {
-    _detach_from_list(&slab_node->snode);
-    _merge_list(&slab_node->snode, &kmem_cache->slabs_full_head);
+void *kmem_cache_alloc(CacheNode *cache_node) { return cache_alloc(cache_node); }
+
+void kmem_cache_free(CacheNode *cache_node, void *p) {
+  ASSERT(obj_to_slab(p)->owner_cache == cache_node);
+  cache_free(cache_node, p);
+}
+
+// Allocate `n` objects into `objs`: the array cache of this CPU is emptied
+// first and the rest come from the slabs under one lock. Returns the number
+// of objects allocated, which is less than `n` only when memory runs out.
+int kmem_cache_alloc_batch(CacheNode *cache_node, void **objs, int n) {
+  int i = 0;
+  bool t = _arch_disable_trap();
+  Array_cache_t *ac = &(cache_node->array_cache[cpuid()]);
+  while (i < n && ac->avail > 0)
+    objs[i++] = ac->entry[--ac->avail];
+  if (i < n) {
+    ac->misses++;
+    setup_checker(one);
+    acquire_spinlock(one, &cache_node->lock);
+    while (i < n && (objs[i] = cache_alloc_obj(cache_node)) != NULL)
+      i++;
+    release_spinlock(one, &cache_node->lock);
   }
-  release_spinlock(one, &mem_lock);
-  return ret;
+  ac->allocs += i;
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  return i;
 }
 
-// find in the global slab: full or partial. from different slabs.kmem_cache
-void cache_flusharray(Array_cache_t *ac, CacheNode *cache_node) {
-  SlabNode *flush_slab = (SlabNode *)PAGE_BASE((u64)(ac->entry[--ac->avail]));
-  flush_slab->freelist[--flush_slab->active] =
-      get_obj_index(flush_slab, cache_node->object_size, cache_node->num,
-                    ac->entry[ac->avail]);
-  _detach_from_list(&flush_slab->snode);
-  if (flush_slab->active == cache_node->num - 1) {
-    _insert_into_list(&cache_node->slabs_partial_head, &flush_slab->snode);
-  } else if (flush_slab->active == 0) {
-    _insert_into_list(&cache_node->slabs_free_head, &flush_slab->snode);
+// the array cache of this CPU takes the objects while it has room; the rest go
+// back to their slabs under one lock.
+static void cache_free_batch(CacheNode *cache_node, void **objs, int n) {
+  int i = 0;
+  bool t = _arch_disable_trap();
+  Array_cache_t *ac = &(cache_node->array_cache[cpuid()]);
+  while (i < n && ac->avail < AC_LIMIT)
+    ac->entry[ac->avail++] = objs[i++];
+  if (i < n) {
+    ac->flushes++;
+    setup_checker(one);
+    acquire_spinlock(one, &cache_node->lock);
+    while (i < n)
+      cache_free_obj(cache_node, objs[i++]);
+    release_spinlock(one, &cache_node->lock);
   }
+  ac->frees += n;
+  if (t)
+    ASSERT(!_arch_enable_trap());
 }
 
-void kfree(void *p) {
-  setup_checker(one);
-  acquire_spinlock(one, &mem_lock);
-  SlabNode *owner_slab = (SlabNode *)PAGE_BASE((u64)p);
-  auto kmem_cache = owner_slab->owner_cache;
-  Array_cache_t *ac = &(kmem_cache->array_cache[cpuid()]);
-  if (ac->avail == AC_LIMIT) {
-    cache_flusharray(ac, kmem_cache);
+void kmem_cache_free_batch(CacheNode *cache_node, void **objs, int n) {
+  for (int i = 0; i < n; i++)
+    ASSERT(obj_to_slab(objs[i])->owner_cache == cache_node);
+  cache_free_batch(cache_node, objs, n);
+}
+
+// kalloc `n` objects of the same size, see kmem_cache_alloc_batch.
+int kalloc_batch(isize size, void **objs, int n) {
+  if (size > MAX_CLASS_SIZE) {
+    int i = 0;
+    while (i < n && (objs[i] = kalloc_pages(size_to_order(size))) != NULL)
+      i++;
+    return i;
   }
-  ac->entry[ac->avail++] = p;
-  if (ac->avail == 0 && _empty_list(&kmem_cache->slabs_full_head) &&
-      _empty_list(&kmem_cache->slabs_partial_head)) {
-    kfree_page((void *)PAGE_BASE((u64)p));
+  return kmem_cache_alloc_batch(&kmem_cache_array[size_index[(size + 7) / 8]],
+                                objs, n);
+}
+
+// kfree `n` objects. Each run of objects from the same cache is freed with one
+// lock round-trip.
+void kfree_batch(void **objs, int n) {
+  int i = 0;
+  while (i < n) {
+    auto page = virt_to_page(objs[i]);
+    if (!(page->flags & PAGE_SLAB)) {
+      kfree_pages(objs[i++], page->order);
+      continue;
+    }
+    auto cache_node = obj_to_slab(objs[i])->owner_cache;
+    int j = i + 1;
+    while (j < n && (virt_to_page(objs[j])->flags & PAGE_SLAB) &&
+           obj_to_slab(objs[j])->owner_cache == cache_node)
+      j++;
+    cache_free_batch(cache_node, objs + i, j - i);
+    i = j;
   }
+}
 
-  release_spinlock(one, &mem_lock);
+// give the objects in this CPU's array caches back to their slabs, so that the
+// slabs they keep alive can become free.
+static void drain_local_array_caches() {
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&cache_chain_lock);
+  _for_in_list(p, &cache_chain) {
+    if (p == &cache_chain)
+      continue;
+    auto cache_node = container_of(p, CacheNode, cnode);
+    auto ac = &cache_node->array_cache[cpuid()];
+    _acquire_spinlock(&cache_node->lock);
+    while (ac->avail > 0)
+      cache_free_obj(cache_node, ac->entry[--ac->avail]);
+    _release_spinlock(&cache_node->lock);
+  }
+  _release_spinlock(&cache_chain_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
 }
 
-u64 left_page_cnt() {
-  _acquire_spinlock(&refcnt_lock);
-  auto ret = total_page() - alloc_page_cnt.count;
-  _release_spinlock(&refcnt_lock);
-  return ret;
+// the objects cached by this CPU are flushed first, so the slabs they emptied
+// are counted.
+static u64 slab_shrink_count() {
+  drain_local_array_caches();
+  u64 cnt = 0;
+  _acquire_spinlock(&cache_chain_lock);
+  _for_in_list(p, &cache_chain) {
+    if (p == &cache_chain)
+      continue;
+    auto cache_node = container_of(p, CacheNode, cnode);
+    _acquire_spinlock(&cache_node->lock);
+    _for_in_list(q, &cache_node->slabs_free_head) {
+      if (q != &cache_node->slabs_free_head)
+        cnt += 1 << cache_node->pgorder;
+    }
+    _release_spinlock(&cache_node->lock);
+  }
+  _release_spinlock(&cache_chain_lock);
+  return cnt;
 }
 
-u32 write_page_to_disk(void *ka) {
-  auto first_bno = find_and_set_8_blocks();
-  for (u32 i = 0; i < 8; i++) {
-    auto block = bcache.acquire(first_bno + i);
-    attach_pgdir(&thisproc()->pgdir);
-    PTEntriesPtr pte_p =
-        get_pte(&thisproc()->pgdir, (u64)(ka + i * BLOCK_SIZE), FALSE);
-    if (pte_p != NULL && *pte_p != 0) {
-      memcpy(block->data, (void *)(P2K(PTE_ADDRESS(*pte_p))), BLOCK_SIZE);
-      bcache.sync(NULL, block);
+// free empty slabs until `nr` pages are returned to the page allocator.
+static u64 slab_shrink_scan(u64 nr) {
+  u64 freed = 0;
+  _acquire_spinlock(&cache_chain_lock);
+  _for_in_list(p, &cache_chain) {
+    if (p == &cache_chain)
+      continue;
+    auto cache_node = container_of(p, CacheNode, cnode);
+    while (freed < nr) {
+      _acquire_spinlock(&cache_node->lock);
+      if (_empty_list(&cache_node->slabs_free_head)) {
+        _release_spinlock(&cache_node->lock);
+        break;
+      }
+      auto slab_node = container_of(cache_node->slabs_free_head.next,
+                                    struct SlabNode, snode);
+      _detach_from_list(&slab_node->snode);
+      _release_spinlock(&cache_node->lock);
+      int order = cache_node->pgorder;
+      auto page = virt_to_page(slab_node);
+      for (int i = 0; i < 1 << order; i++) {
+        page[i].flags = 0;
+        page[i].order = 0;
+      }
+      page->order = order;
+      kfree_pages(slab_node, order);
+      freed += 1 << order;
     }
-    bcache.release(block);
   }
-  return first_bno;
+  _release_spinlock(&cache_chain_lock);
+  return freed;
+}
+
+static struct shrinker slab_shrinker = {
+    .name = "slab",
+    .count = slab_shrink_count,
+    .scan = slab_shrink_scan,
+};
+
+// shrinkers are kept in reverse order of registration, so the slab shrinker,
+// registered first, runs last and frees the slabs emptied by the others.
+void register_shrinker(struct shrinker *s) {
+  _acquire_spinlock(&shrinker_lock);
+  _insert_into_list(&shrinker_head, &s->node);
+  _release_spinlock(&shrinker_lock);
+}
+
+u64 shrink_memory(u64 nr) {
+  u64 before = left_page_cnt();
+  _acquire_spinlock(&shrinker_lock);
+  _for_in_list(p, &shrinker_head) {
+    if (p == &shrinker_head)
+      continue;
+    if (left_page_cnt() >= before + nr)
+      break;
+    auto s = container_of(p, struct shrinker, node);
+    u64 cnt = s->count();
+    if (cnt > 0)
+      s->scan(cnt);
+  }
+  _release_spinlock(&shrinker_lock);
+  u64 after = left_page_cnt();
+  return after > before ? after - before : 0;
 }
 
-void read_page_from_disk(void *ka, u32 bno) {
-  if (!((u64)ka & KSPACE_MASK)) {
-    printk("not kernel addr\n");
-    PANIC();
+// Print allocator statistics, one record per line. Every record is a kind
+// followed by key=value fields; new fields are only ever appended, so
+// parsers should look fields up by key. Counters are read without stopping
+// the other CPUs, so they are only consistent when the allocator is idle.
+//
+//   kmemstat version=1
+//   pages total= used= free=
+//   zeropool pages= hits= misses=
+//   buddy order= free_blocks=
+//   cpu id= page_allocs= page_frees= mag_pages= mag_fills= mag_drains=
+//       kallocs= kfrees= ac_misses= ac_flushes=
+//   cache name= obj_size= objs_per_slab= pages_per_slab= allocs= frees=
+//       ac_hits= ac_misses= ac_objs= slabs_partial= slabs_full= slabs_free=
+//       active_objs= wasted_bytes=
+//   end
+//
+// (cpu and cache records are printed on one line.) `wasted_bytes` is the slab
+// memory not holding live objects: slab headers, tails and free objects.
+void kmem_stat_dump() {
+  printk("kmemstat version=1\n");
+  isize used = alloc_page_cnt();
+  printk("pages total=%d used=%lld free=%lld\n", total_page(), used,
+         (i64)total_page() - used);
+  printk("zeropool pages=%d hits=%llu misses=%llu\n", zero_pool.cnt,
+         zero_pool.hits, zero_pool.misses);
+  usize free_blocks[MAX_ORDER];
+  bool t = _arch_disable_trap();
+  _acquire_spinlock(&buddy_lock);
+  memcpy(free_blocks, free_cnt, sizeof(free_blocks));
+  _release_spinlock(&buddy_lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  for (int i = 0; i < MAX_ORDER; i++)
+    printk("buddy order=%d free_blocks=%llu\n", i, (u64)free_blocks[i]);
+  for (int i = 0; i < CPU_NUM; i++) {
+    auto mag = &page_mag[i];
+    u64 kallocs = 0, kfrees = 0, misses = 0, flushes = 0;
+    _acquire_spinlock(&cache_chain_lock);
+    _for_in_list(p, &cache_chain) {
+      if (p == &cache_chain)
+        continue;
+      auto ac = &container_of(p, CacheNode, cnode)->array_cache[i];
+      kallocs += ac->allocs;
+      kfrees += ac->frees;
+      misses += ac->misses;
+      flushes += ac->flushes;
+    }
+    _release_spinlock(&cache_chain_lock);
+    printk("cpu id=%d page_allocs=%llu page_frees=%llu mag_pages=%d "
+           "mag_fills=%llu mag_drains=%llu kallocs=%llu kfrees=%llu "
+           "ac_misses=%llu ac_flushes=%llu\n",
+           i, mag->allocs, mag->frees, mag->cnt, mag->fills, mag->drains,
+           kallocs, kfrees, misses, flushes);
   }
-  for (u32 i = 0; i < 8; i++) {
-    auto block = bcache.acquire(bno + i);
-    memcpy(ka + i * BLOCK_SIZE, block->data, BLOCK_SIZE);
-    bcache.release(block);
+  _acquire_spinlock(&cache_chain_lock);
+  _for_in_list(p, &cache_chain) {
+    if (p == &cache_chain)
+      continue;
+    auto cache_node = container_of(p, CacheNode, cnode);
+    u64 allocs = 0, frees = 0, misses = 0, ac_objs = 0;
+    for (int i = 0; i < CPU_NUM; i++) {
+      auto ac = &cache_node->array_cache[i];
+      allocs += ac->allocs;
+      frees += ac->frees;
+      misses += ac->misses;
+      ac_objs += ac->avail;
+    }
+    u64 slabs[3] = {0, 0, 0}, in_slabs = 0;
+    ListNode *heads[3] = {&cache_node->slabs_partial_head,
+                          &cache_node->slabs_full_head,
+                          &cache_node->slabs_free_head};
+    _acquire_spinlock(&cache_node->lock);
+    for (int k = 0; k < 3; k++) {
+      _for_in_list(q, heads[k]) {
+        if (q == heads[k])
+          continue;
+        slabs[k]++;
+        in_slabs += container_of(q, struct SlabNode, snode)->active;
+      }
+    }
+    _release_spinlock(&cache_node->lock);
+    u64 active = in_slabs > ac_objs ? in_slabs - ac_objs : 0;
+    u64 bytes =
+        (slabs[0] + slabs[1] + slabs[2]) * (PAGE_SIZE << cache_node->pgorder);
+    printk("cache name=%s obj_size=%lld objs_per_slab=%u pages_per_slab=%d "
+           "allocs=%llu frees=%llu ac_hits=%llu ac_misses=%llu ac_objs=%llu "
+           "slabs_partial=%llu slabs_full=%llu slabs_free=%llu "
+           "active_objs=%llu wasted_bytes=%llu\n",
+           cache_node->name, cache_node->object_size, cache_node->num,
+           1 << cache_node->pgorder, allocs, frees,
+           allocs > misses ? allocs - misses : 0, misses, ac_objs, slabs[0],
+           slabs[1], slabs[2], active,
+           bytes - active * cache_node->object_size);
   }
+  _release_spinlock(&cache_chain_lock);
+  printk("end\n");
 }
 
+define_syscall(kmemstat) {
+  kmem_stat_dump();
+  return 0;
+}
+
+u64 left_page_cnt() { return total_page() - alloc_page_cnt(); }
+
+// every mapping of the zero page holds a reference, dropped by kfree_page.
 void *get_zero_page() {
-  if (zero_page == NULL) {
-    zero_page = kalloc_page();
-    init_rc(&zero_page_cnt);
-    _increment_rc(&alloc_page_cnt);
-  }
-  _increment_rc(&zero_page_cnt);
+  get_page(zero_page);
   return zero_page;
 }
 
+bool is_zero_page(void *p) { return p == zero_page; }
+
 bool check_zero_page() {
 
   for (auto i = 0; i < PAGE_SIZE; i++) {
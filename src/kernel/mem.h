@@ -9,21 +9,84 @@
 #define TOTAL_PHY_PAGES                                                        \
   (P2K(PHYSTOP) - PAGE_BASE((u64)&end) - PAGE_SIZE) / PAGE_SIZE
 
+// Metadata of a physical page. There is one for every page the allocator
+// manages, kept in an array indexed by page2index.
 struct page {
-  // QueueNode node;
-  RefCount ref;
+  RefCount ref; // the page is freed when the last reference is dropped
+  void *owner;  // hint of who uses the page, e.g. the CacheNode of a slab
+  u8 flags;
+  u8 order; // order of the block this page heads
+  // for a page table: how many of its entries are not empty, and a range
+  // [pte_lo, pte_hi) that they all lie in. See set_pte.
+  u16 pte_cnt, pte_lo, pte_hi;
 };
 
-#define PAGE_META(p) p + PAGE_SIZE - sizeof(struct page)
+#define PAGE_FREE 0x1 // the page heads a free block of the buddy allocator
+#define PAGE_SLAB 0x2 // the page belongs to a slab
+
+int page2index(void *);
+struct page *virt_to_page(void *);
+void *page_to_virt(struct page *);
 
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
+void get_page(void *);
+isize page_ref_cnt(void *);
+WARN_RESULT void *kalloc_zeroed_page();
+// bulk versions that take the allocator locks once per call.
+WARN_RESULT int kalloc_page_batch(void **pages, int n);
+void kfree_page_batch(void **pages, int n);
+// collects pages to drop, freeing them PAGE_BATCH_SIZE at a time.
+#define PAGE_BATCH_SIZE 16
+struct page_batch {
+  int cnt;
+  void *pages[PAGE_BATCH_SIZE];
+};
+void page_batch_add(struct page_batch *, void *);
+void page_batch_flush(struct page_batch *);
+bool zero_idle_page();
+WARN_RESULT void *kalloc_pages(int order);
+void kfree_pages(void *, int order);
+void split_pages(void *, int order);
 
 WARN_RESULT void *kalloc(isize);
 void kfree(void *);
+WARN_RESULT int kalloc_batch(isize size, void **objs, int n);
+void kfree_batch(void **objs, int n);
+
+#define CACHE_LINE_SIZE 64
+
+// A cache of objects of one type. Objects are built by `ctor` when their slab
+// is created and must be freed in the constructed state, so an allocation
+// only has to set up what differs between uses. `kfree` also accepts them.
+typedef struct CacheNode CacheNode;
+CacheNode *kmem_cache_create(const char *name, isize size, isize align,
+                             void (*ctor)(void *));
+WARN_RESULT void *kmem_cache_alloc(CacheNode *);
+void kmem_cache_free(CacheNode *, void *);
+WARN_RESULT int kmem_cache_alloc_batch(CacheNode *, void **objs, int n);
+void kmem_cache_free_batch(CacheNode *, void **objs, int n);
 
+isize alloc_page_cnt();
 u64 left_page_cnt();
+
+// A shrinker drops memory its subsystem keeps only as a cache. `count`
+// returns how many objects `scan` could free; `scan(nr)` frees up to `nr`
+// of them and returns how many it freed.
+struct shrinker {
+  const char *name;
+  u64 (*count)();
+  u64 (*scan)(u64 nr);
+  ListNode node;
+};
+
+void register_shrinker(struct shrinker *);
+// run the shrinkers until `nr` pages are back in the page allocator.
+// returns the number of pages reclaimed.
+u64 shrink_memory(u64 nr);
+
+// print per-CPU and per-cache allocator statistics. See mem.c for the format.
+void kmem_stat_dump();
 WARN_RESULT void *get_zero_page();
+bool is_zero_page(void *);
 bool check_zero_page();
-u32 write_page_to_disk(void *ka);
-void read_page_from_disk(void *ka, u32 bno);
@@ -2,12 +2,14 @@
 #include "common/spinlock.h"
 #include "driver/sd.h"
 #include <aarch64/mmu.h>
+#include <aarch64/trap.h>
 #include <common/defines.h>
 #include <common/list.h>
 #include <common/sem.h>
 #include <common/string.h>
 #include <fs/block_device.h>
 #include <fs/cache.h>
+#include <fs/swap.h>
 #include <kernel/init.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
@@ -15,9 +17,44 @@
 #include <kernel/proc.h>
 #include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/syscall.h>
+#include <kernel/zswap.h>
 
 extern BlockDevice block_device;
 
+static CacheNode *section_cache;
+
+static void section_ctor(void *p) {
+  struct section *st = p;
+  memset(st, 0, sizeof(*st));
+  init_sleeplock(&st->sleeplock);
+  init_list_node(&st->stnode);
+}
+
+// Called by the hook that sets up root_proc, which needs it before any other
+// page table can exist, since hooks of one phase run in no set order.
+void init_section_cache() {
+  section_cache = kmem_cache_create("section", sizeof(struct section),
+                                    CACHE_LINE_SIZE, section_ctor);
+}
+
+// Reclaim swaps out single pages, picked by CLOCK over the page tables on
+// reclaim_list: the hand of a table walks its private pages in address order.
+// A page that was accessed since the hand last passed it loses its access
+// flag and is kept; the next access takes a fault that sets the flag again.
+// A page that was not is swapped out. Only offline tables are scanned, the
+// one that is likely to give up the most pages it will not need back first.
+static SpinLock reclaim_lock;
+static ListNode reclaim_list;
+// held while pages are written out, and while one is read back.
+static SleepLock swap_lock;
+
+define_early_init(reclaim) {
+  init_spinlock(&reclaim_lock);
+  init_list_node(&reclaim_list);
+  init_sleeplock(&swap_lock);
+}
+
 define_rest_init(paging) {
   // TODO init
   // init_sections(&thisproc()->pgdir.section_head);
@@ -28,29 +65,319 @@ define_rest_init(paging) {
   // init_bcache(get_super_block(), &block_device);
 }
 
-void init_sections(ListNode *section_head) {
-  struct section *heap_section = kalloc(sizeof(struct section));
-  memset(heap_section, 0, sizeof(struct section));
-  heap_section->flags |= ST_HEAP;
-  init_sleeplock(&heap_section->sleeplock);
-  init_list_node(&heap_section->stnode);
-  _merge_list(&heap_section->stnode, section_head);
+static bool section_cmp(rb_node lnode, rb_node rnode) {
+  auto l = container_of(lnode, struct section, stree);
+  auto r = container_of(rnode, struct section, stree);
+  if (l->begin != r->begin) {
+    return l->begin < r->begin;
+  }
+  return l < r;
 }
 
-u64 sbrk(i64 size) {
-  ListNode *section_head = &thisproc()->pgdir.section_head;
+// add `section` to the list and the tree of `pd`.
+static void add_section(struct pgdir *pd, struct section *section) {
+  _insert_into_list(pd->section_head.prev, &section->stnode);
+  ASSERT(!_rb_insert(&section->stree, &pd->section_tree, section_cmp));
+  if (section->flags & ST_HEAP) {
+    pd->heap = section;
+  }
+}
+
+void init_sections(struct pgdir *pd) {
+  struct section *heap_section = kmem_cache_alloc(section_cache);
+  heap_section->flags = ST_HEAP;
+  heap_section->begin = heap_section->end = 0;
+  add_section(pd, heap_section);
+  insert_into_list(&reclaim_lock, &reclaim_list, &pd->reclaim_node);
+}
+
+// The section that contains `va`, or NULL. Sections do not overlap, so it
+// can only be the one with the greatest begin not above `va`. Faults tend to
+// hit the same section again, so that one is tried first.
+struct section *lookup_section(struct pgdir *pd, u64 va) {
+  auto last = pd->last_section;
+  if (last != NULL && last->begin <= va && va < last->end) {
+    return last;
+  }
+  struct section *section = NULL;
+  rb_node node = pd->section_tree.rb_node;
+  while (node != NULL) {
+    auto s = container_of(node, struct section, stree);
+    if (s->begin <= va) {
+      section = s;
+      node = node->rb_right;
+    } else {
+      node = node->rb_left;
+    }
+  }
+  if (section == NULL || va >= section->end) {
+    return NULL;
+  }
+  pd->last_section = section;
+  return section;
+}
+
+// the first section of `pd` that ends after `va`.
+static struct section *next_section(struct pgdir *pd, u64 va) {
   struct section *section = NULL;
+  rb_node node = pd->section_tree.rb_node;
+  while (node != NULL) {
+    auto s = container_of(node, struct section, stree);
+    if (s->end > va) {
+      section = s;
+      node = node->rb_left;
+    } else {
+      node = node->rb_right;
+    }
+  }
+  return section;
+}
+
+// drop what keeps the page of the swap entry `pte`.
+static void release_swap_entry(PTEntry pte) {
+  if (SWAP_TYPE(pte) == SWAP_DISK) {
+    free_swap_slot(pte >> 12);
+  } else {
+    zswap_free(pte);
+  }
+}
+
+// the first block of the slot that holds the page of the swap entry `pte`, or
+// 0 if the page is kept in memory.
+static u32 swap_entry_slot(PTEntry pte) {
+  if (SWAP_TYPE(pte) == SWAP_DISK) {
+    return (u32)(pte >> 12);
+  }
+  if (SWAP_TYPE(pte) == SWAP_ZPOOL) {
+    return zswap_slot(pte);
+  }
+  return 0;
+}
+
+static bool is_swap_entry(PTEntry pte) {
+  return pte != 0 && !(pte & PTE_VALID);
+}
+
+// a page taken out of a page table, to be written to its swap slot.
+struct swap_victim {
+  void *page;
+  u32 bno;
+};
+
+// Replace the entry of the resident `*pte` with a swap entry. Pages that are
+// all zero or compress well stay in memory; the others get a swap slot, and
+// are recorded in `v` to be written out. The zero page is only unmapped.
+// Returns whether `v` is used.
+static bool evict_page(PTEntriesPtr pte, struct swap_victim *v) {
+  auto page = (void *)P2K(PTE_ADDRESS(*pte));
+  if (is_zero_page(page)) {
+    set_pte(pte, 0);
+    kfree_page(page);
+    return false;
+  }
+  PTEntry entry = zswap_store(page);
+  if (entry != 0) {
+    *pte = entry;
+    kfree_page(page);
+    return false;
+  }
+  v->page = page;
+  v->bno = alloc_swap_slot();
+  *pte = (u64)v->bno << 12;
+  return true;
+}
+
+// Write the victims out and free their pages. They usually went to adjacent
+// slots and are written as one request. swap_lock must be held.
+static void write_victims(struct swap_victim *v, int n) {
+  u32 bno[SWAP_BATCH];
+  u8 *pages[SWAP_BATCH];
+  for (int i = 0; i < n; i++) {
+    bno[i] = v[i].bno;
+    pages[i] = v[i].page;
+  }
+  swap_write_pages(bno, pages, (usize)n);
+  for (int i = 0; i < n; i++) {
+    kfree_page(v[i].page);
+  }
+}
 
-  _for_in_list(sp, section_head) {
-    if (sp == section_head) {
+// Lock `pd` once it is not online on another CPU. Traps stay disabled while
+// it is held, so it cannot go online here either. Returns the trap state.
+static bool lock_pgdir(struct pgdir *pd) {
+  while (1) {
+    bool t = _arch_disable_trap();
+    _acquire_spinlock(&pd->lock);
+    if (&thisproc()->pgdir == pd || !pd->online) {
+      return t;
+    }
+    _release_spinlock(&pd->lock);
+    if (t)
+      ASSERT(!_arch_enable_trap());
+  }
+}
+
+static void unlock_pgdir(struct pgdir *pd, bool t) {
+  _release_spinlock(&pd->lock);
+  if (t)
+    ASSERT(!_arch_enable_trap());
+}
+
+// the CLOCK hand of `pd` has come round: the round it made is what it knows
+// of the working set now, and older evictions and refaults count half.
+static void end_clock_round(struct pgdir *pd) {
+  pd->resident = pd->round_resident;
+  pd->active = pd->round_active;
+  pd->round_resident = pd->round_active = 0;
+  pd->evicted /= 2;
+  pd->refaults /= 2;
+}
+
+// Move the CLOCK hand of the locked `pd` over up to CLOCK_SCAN_PAGES pages,
+// and evict at most `max` of them, `*n` of which are left in `v` to be
+// written out. Pages that are shared with a forked copy or in shared tables
+// would free nothing, so they are passed over. A block is split into pages
+// when the hand reaches it, and they are scanned like any others. Returns
+// the number of pages evicted.
+static int clock_scan(struct pgdir *pd, struct swap_victim *v, int *n,
+                      int max) {
+  int evicted = 0, scanned = 0;
+  *n = 0;
+  bool flush = false;
+  u64 va = pd->clock_hand;
+  while (evicted < max && scanned < CLOCK_SCAN_PAGES) {
+    auto st = next_section(pd, va);
+    if (st == NULL) {
+      // start over from the bottom next time.
+      end_clock_round(pd);
+      va = 0;
+      break;
+    }
+    va = MAX(va, PAGE_BASE(st->begin));
+    u64 next = MIN((va & ~(HUGE_PAGE_SIZE - 1)) + HUGE_PAGE_SIZE, st->end);
+    auto pte = lookup_pte(pd, va);
+    if (pte == NULL && !(st->flags & ST_FILE) &&
+        lookup_block(pd, va) != NULL) {
+      // blocks are private, and get_pte splits them.
+      pte = get_pte(pd, va, false);
+    }
+    if ((st->flags & ST_FILE) || pte == NULL || shared_pte(pd, va)) {
+      scanned += (next - va) / PAGE_SIZE;
+      va = next;
+      continue;
+    }
+    for (; va < next && evicted < max && scanned < CLOCK_SCAN_PAGES;
+         va += PAGE_SIZE, pte++, scanned++) {
+      if (!(*pte & PTE_VALID) ||
+          page_ref_cnt((void *)P2K(PTE_ADDRESS(*pte))) > 1) {
+        continue;
+      }
+      pd->round_resident++;
+      if (*pte & AF_USED) {
+        pd->round_active++;
+        *pte &= ~AF_USED;
+      } else {
+        *n += evict_page(pte, &v[*n]);
+        evicted++;
+      }
+      flush = true;
+    }
+  }
+  pd->clock_hand = va;
+  pd->evicted += (u32)evicted;
+  if (flush) {
+    tlbi_pgdir(pd);
+  }
+  return evicted;
+}
+
+// What reclaim expects of the offline `pd`: the pages it did not use in the
+// last round of the hand, weighed up the longer it has not run. One that
+// faulted back half of what was taken from it lately, and ran since, would
+// soon fault the rest back too, so it scores 0 and is only picked when no
+// other is left.
+static u64 reclaim_score(struct pgdir *pd, u64 now) {
+  u64 idle = 0;
+  if (now > pd->last_run) {
+    idle = (now - pd->last_run) /
+           (get_clock_frequency() / 1000 * RECLAIM_IDLE_MS);
+  }
+  idle = MIN(idle, (u64)RECLAIM_IDLE_MAX);
+  if (pd->refaults > 0 && 2 * pd->refaults >= pd->evicted &&
+      idle < RECLAIM_IDLE_MAX) {
+    return 0;
+  }
+  u64 cold = MAX(pd->resident - pd->active,
+                 pd->round_resident - pd->round_active);
+  return (cold + 1) * (idle + 1);
+}
+
+// Lock the offline page table on reclaim_list with the best reclaim_score and
+// move it to the back, so that equal ones take turns. Returns NULL if there is
+// none. Page tables are taken off the list before they are freed, so a locked
+// one stays alive.
+static struct pgdir *next_clock_pgdir(bool *t) {
+  struct pgdir *pd = NULL;
+  u64 best = 0, now = get_timestamp();
+  *t = _arch_disable_trap();
+  _acquire_spinlock(&reclaim_lock);
+  _for_in_list(p, &reclaim_list) {
+    if (p == &reclaim_list) {
+      continue;
+    }
+    auto cand = container_of(p, struct pgdir, reclaim_node);
+    if (cand == &thisproc()->pgdir || !_try_acquire_spinlock(&cand->lock)) {
       continue;
     }
-    struct section *section_p = container_of(sp, struct section, stnode);
-    if (section_p->flags & ST_HEAP) {
-      section = section_p;
+    u64 score = cand->online ? 0 : reclaim_score(cand, now);
+    if (!cand->online && (pd == NULL || score > best)) {
+      if (pd != NULL)
+        _release_spinlock(&pd->lock);
+      pd = cand;
+      best = score;
+    } else {
+      _release_spinlock(&cand->lock);
+    }
+  }
+  if (pd != NULL) {
+    _detach_from_list(&pd->reclaim_node);
+    _insert_into_list(reclaim_list.prev, &pd->reclaim_node);
+  }
+  _release_spinlock(&reclaim_lock);
+  if (pd == NULL && *t)
+    ASSERT(!_arch_enable_trap());
+  return pd;
+}
+
+// Swap out up to `n` cold pages of offline processes. Gives up after the
+// hands have passed twice over as many pages as there are, since by then
+// every page has had its second chance. Returns the number of pages freed.
+int clock_reclaim(int n) {
+  struct swap_victim v[SWAP_BATCH];
+  int freed = 0;
+  u64 budget = 2 * (u64)alloc_page_cnt();
+  setup_checker(0);
+  unalertable_acquire_sleeplock(0, &swap_lock);
+  while (freed < n && budget >= CLOCK_SCAN_PAGES) {
+    bool t;
+    zswap_reserve(SWAP_BATCH);
+    auto pd = next_clock_pgdir(&t);
+    if (pd == NULL) {
       break;
     }
+    int victims;
+    int cnt = clock_scan(pd, v, &victims, MIN(n - freed, SWAP_BATCH));
+    unlock_pgdir(pd, t);
+    write_victims(v, victims);
+    freed += cnt;
+    budget -= CLOCK_SCAN_PAGES;
   }
+  release_sleeplock(0, &swap_lock);
+  return freed;
+}
+
+u64 sbrk(i64 size) {
+  struct section *section = thisproc()->pgdir.heap;
 
   if (section == NULL) {
     printk("no heap section\n");
@@ -65,143 +392,287 @@ u64 sbrk(i64 size) {
     sz *= -1;
     if (sz <= (i64)(section->end - section->begin)) {
       // 不需要拿section的sleeplock
-      while (sz > 0) {
-        section->end -= PAGE_SIZE;
-        PTEntriesPtr pte_p = get_pte(&thisproc()->pgdir, section->end, FALSE);
-        if (pte_p != NULL && *pte_p != 0 && !(*pte_p & PTE_VALID)) {
-          release_8_blocks(*pte_p >> 12);
-        } else if (pte_p != NULL && *pte_p != 0 && (*pte_p & PTE_VALID)) {
-          kfree_page((void *)P2K(PTE_ADDRESS(*pte_p)));
-        }
-        if (pte_p != NULL) {
-          memset(pte_p, 0, sizeof(PTEntry));
-        }
-        sz -= PAGE_SIZE;
-      }
+      section->end -= sz;
+      vmunmap_range(&thisproc()->pgdir, section->end, section->end + sz,
+                    release_swap_entry);
     } else {
       printk("no enough space in heap section\n");
       PANIC();
     }
   }
-  arch_tlbi_vmalle1is();
 
   return ret_addr;
 }
 
-void *alloc_page_for_user() {
+// make room for one more user page, reclaiming or swapping if needed.
+static void reserve_page_for_user() {
   //若两个CPU获得了样的cnt开始分配页，而一个分配完成后，另一个再进入就已经达到软上限,所以要加锁
   while (left_page_cnt() <= REVERSED_PAGES) { // this is a soft limit
-                                              // TODO
-    while (1) {
-      auto pd = &get_offline_proc()->pgdir;
-      struct section *section = NULL;
-      _for_in_list(p, &pd->section_head) {
-        if (p == &pd->section_head) {
-          continue;
-        }
-        if (p != NULL) {
-          section = container_of(p, struct section, stnode);
-        }
-      }
-      if (section != NULL) {
-        swapout(pd, section);
-        break;
-      }
-      printk("proc has no section\n");
+    // dropping clean caches is cheaper than swapping.
+    if (shrink_memory(REVERSED_PAGES + 1 - left_page_cnt()) > 0)
+      continue;
+    if (clock_reclaim(REVERSED_PAGES + 1 - left_page_cnt()) == 0) {
+      printk("no page to swap out\n");
+      PANIC();
     }
   }
+}
+
+void *alloc_page_for_user() {
+  reserve_page_for_user();
   return kalloc_page();
 }
 
-// caller must have the pd->lock
+// for anonymous memory, which must read as zeroes.
+void *alloc_zeroed_page_for_user() {
+  reserve_page_for_user();
+  return kalloc_zeroed_page();
+}
+
+// Swap out every resident page of `st`, whether or not it was accessed.
+// Pages shared with a forked copy are written out for this page table only.
 void swapout(struct pgdir *pd, struct section *st) {
-  while (1) {
-    _acquire_spinlock(&pd->lock);
-    if (!(&thisproc()->pgdir != pd && pd->online)) {
-      break;
-    }
-    _release_spinlock(&pd->lock);
+  if (st->flags & ST_FILE) {
+    return;
   }
-
-  // _release_spinlock(&pd->lock);
-  ASSERT(!(st->flags & ST_SWAP));
-  st->flags |= ST_SWAP;
-  u64 begin = st->begin, end = st->end;
-  for (u64 va = st->begin; va <= st->end; va += PAGE_SIZE) {
-    PTEntriesPtr pte_p = get_pte(pd, va, FALSE);
-    if (pte_p != NULL && *pte_p != 0) {
-      *pte_p &= ~PTE_VALID;
+  struct swap_victim v[SWAP_BATCH];
+  setup_checker(0);
+  unalertable_acquire_sleeplock(0, &swap_lock);
+  for (u64 va = PAGE_BASE(st->begin); va < st->end;) {
+    zswap_reserve(SWAP_BATCH);
+    bool t = lock_pgdir(pd);
+    int n = 0, evicted = 0;
+    while (va < st->end && evicted < SWAP_BATCH) {
+      u64 next = MIN((va & ~(HUGE_PAGE_SIZE - 1)) + HUGE_PAGE_SIZE, st->end);
+      auto pte = get_pte(pd, va, false);
+      for (; pte != NULL && va < next && evicted < SWAP_BATCH;
+           va += PAGE_SIZE, pte++) {
+        if (*pte & PTE_VALID) {
+          n += evict_page(pte, &v[n]);
+          evicted++;
+        }
+      }
+      if (pte == NULL) {
+        va = next;
+      }
     }
+    pd->evicted += (u32)evicted;
+    tlbi_pgdir(pd);
+    unlock_pgdir(pd, t);
+    write_victims(v, n);
   }
+  release_sleeplock(0, &swap_lock);
+}
 
-  setup_checker(0);
-  ASSERT(acquire_sleeplock(0, &st->sleeplock));
-  // if (_try_acquire_spinlock(&pd->lock)) {
-  //   // printk("swap out: not online\n");
-  // }
-  _release_spinlock(&pd->lock);
+// The window of `pages` pages around `addr` that a fault also serves: aligned
+// to its size and kept within the section `st` and the leaf table of `addr`.
+static void fault_window(struct section *st, u64 addr, int pages, u64 *begin,
+                         u64 *end) {
+  u64 window = (u64)pages * PAGE_SIZE;
+  u64 table = N_PTE_PER_TABLE * PAGE_SIZE;
+  *begin = MAX(addr - addr % window, addr & ~(table - 1));
+  *begin = MAX(*begin, PAGE_BASE(st->begin));
+  *end = MIN(*begin + window, (addr & ~(table - 1)) + table);
+  *end = MIN(*end, st->end);
+}
+
+// Swap-in readahead: a fault on a swapped out page also reads the swapped out
+// pages in a window of swap_readahead_pages pages around it, the way
+// fault-around does. They were mostly evicted together into adjacent slots, so
+// the window takes one request. The neighbours are mapped cold, with
+// PTE_SWAP_RA, and their first touch is a hit. 1 disables it.
+static int swap_readahead_pages = SWAP_READAHEAD_PAGES;
+static struct {
+  u64 misses;    // faults that read from disk
+  u64 readahead; // pages read around them
+  u64 hits;      // of which were touched later
+} swap_readahead_stat;
 
-  if (!(st->flags & ST_FILE)) {
-    for (u64 p = begin; p <= end; p += PAGE_SIZE) {
-      PTEntriesPtr pte_p = get_pte(pd, p, FALSE);
-      if (pte_p != NULL && *pte_p != 0) {
-        auto bno = write_page_to_disk((void *)p);
-        kfree_page((void *)P2K(PTE_ADDRESS(*pte_p)));
-        *pte_p = (bno << 12) & ~PTE_VALID;
+// Bring back the swapped out page at `va` of `st`. A page kept in memory is
+// only decompressed, or mapped to the zero page. A page on disk is read with
+// the rest of its window.
+static void swapin_page(struct pgdir *pd, struct section *st, u64 va) {
+  // reclaim takes swap_lock, so the page is allocated first.
+  void *page = alloc_page_for_user();
+  u32 bno[SWAP_READAHEAD_MAX];
+  u8 *pages[SWAP_READAHEAD_MAX];
+  PTEntriesPtr ptes[SWAP_READAHEAD_MAX];
+  int n = 0;
+  u64 begin, end;
+  fault_window(st, va, swap_readahead_pages, &begin, &end);
+  setup_checker(0);
+  unalertable_acquire_sleeplock(0, &swap_lock);
+  auto pte = get_pte(pd, va, false);
+  if (pte != NULL && is_swap_entry(*pte)) {
+    pd->refaults++;
+  }
+  if (pte != NULL && is_swap_entry(*pte) && swap_entry_slot(*pte) == 0) {
+    PTEntry entry = *pte;
+    if (SWAP_TYPE(entry) == SWAP_ZERO) {
+      *pte = K2P(get_zero_page()) | PTE_USER_DATA | PTE_RO | PTE_VALID;
+    } else {
+      zswap_load(entry, page);
+      *pte = K2P(page) | PTE_USER_DATA | PTE_VALID;
+      page = NULL;
+    }
+    release_swap_entry(entry);
+  } else if (pte != NULL && is_swap_entry(*pte)) {
+    auto pte_p = pte - (PAGE_BASE(va) - begin) / PAGE_SIZE;
+    for (u64 addr = begin; addr < end; addr += PAGE_SIZE, pte_p++) {
+      void *p = page;
+      // the neighbours are only a guess, so never reclaim for them, and only
+      // those on disk are worth it.
+      if (pte_p != pte &&
+          (!is_swap_entry(*pte_p) || swap_entry_slot(*pte_p) == 0 ||
+           left_page_cnt() <= REVERSED_PAGES || (p = kalloc_page()) == NULL)) {
+        continue;
+      }
+      bno[n] = swap_entry_slot(*pte_p);
+      pages[n] = p;
+      ptes[n++] = pte_p;
+    }
+    swap_read_pages(bno, pages, (usize)n);
+    for (int i = 0; i < n; i++) {
+      release_swap_entry(*ptes[i]);
+      *ptes[i] = K2P(pages[i]) | PTE_USER_DATA | PTE_VALID;
+      if (ptes[i] != pte) {
+        *ptes[i] = (*ptes[i] & ~AF_USED) | PTE_SWAP_RA;
       }
     }
+    __atomic_fetch_add(&swap_readahead_stat.misses, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&swap_readahead_stat.readahead, (u64)n - 1,
+                       __ATOMIC_RELAXED);
+    page = NULL;
   }
-  release_sleeplock(0, &st->sleeplock);
+  release_sleeplock(0, &swap_lock);
+  if (page != NULL) {
+    kfree_page(page);
+  }
+}
+
+// Set the swap-in readahead window to `pages` if it is in
+// [1, SWAP_READAHEAD_MAX], and print a record like the ones of kmemstat:
+//   swapra pages= hits= misses= readahead=
+// Returns the window in use.
+define_syscall(swapra, i64 pages) {
+  if (pages >= 1 && pages <= SWAP_READAHEAD_MAX) {
+    swap_readahead_pages = pages;
+  }
+  printk("swapra pages=%d hits=%llu misses=%llu readahead=%llu\n",
+         swap_readahead_pages, swap_readahead_stat.hits,
+         swap_readahead_stat.misses, swap_readahead_stat.readahead);
+  return swap_readahead_pages;
 }
-// Free 8 continuous disk blocks
+
+struct swapin_arg {
+  struct pgdir *pd;
+  struct section *st;
+};
+
+static void swapin_entry(PTEntriesPtr pte, u64 va, void *arg) {
+  struct swapin_arg *a = arg;
+  if (is_swap_entry(*pte)) {
+    swapin_page(a->pd, a->st, va);
+  }
+}
+
+// bring back every swapped out page of `st`.
 void swapin(struct pgdir *pd, struct section *st) {
-  ASSERT(st->flags & ST_SWAP);
-  // TODO
-  setup_checker(0);
-  ASSERT(acquire_sleeplock(0, &st->sleeplock));
-
-  for (u64 p = st->begin; p <= st->end; p += PAGE_SIZE) {
-    PTEntriesPtr pte_p = get_pte(pd, p, FALSE);
-    if (pte_p != NULL && *pte_p != 0) {
-      auto page_p = alloc_page_for_user();
-      read_page_from_disk((void *)page_p, *pte_p >> 12);
-      release_8_blocks(*pte_p >> 12);
-      vmmap(pd, p, page_p, PTE_USER_DATA);
-    }
+  struct swapin_arg a = {pd, st};
+  for_each_pte(pd, PAGE_BASE(st->begin), st->end, swapin_entry, &a);
+}
+
+// back an untouched anonymous page. Reads map the shared zero page, so only
+// pages that are written take memory.
+static void map_anonymous_page(struct pgdir *pd, u64 addr, bool write) {
+  if (write) {
+    auto page = alloc_zeroed_page_for_user();
+    vmmap(pd, addr, page, PTE_USER_DATA | PTE_RW);
+  } else {
+    vmmap(pd, addr, get_zero_page(), PTE_USER_DATA | PTE_RO);
   }
+}
 
-  release_sleeplock(0, &st->sleeplock);
+// Fault-around: a lazy read fault on anonymous memory also maps the untouched
+// pages in a window of fault_around_pages pages around it, within the same
+// section and leaf table, to the zero page. Sequential first reads then take
+// one trap per window, and take no memory. A write fault only maps its own
+// page, since private pages for the neighbours would be taken whether they
+// are used or not. 1 disables it.
+static int fault_around_pages = FAULT_AROUND_PAGES;
+static struct {
+  u64 faults; // lazy anonymous faults
+  u64 mapped; // pages mapped around them
+  u64 blocks; // faults served by a 2 MiB block instead
+} fault_around_stat;
 
-  for (u64 p = st->begin; p <= st->end; p += PAGE_SIZE) {
-    PTEntriesPtr pte_p = get_pte(pd, p, FALSE);
-    if (pte_p != NULL && *pte_p != 0) {
-      *pte_p |= PTE_VALID;
+// Map the whole 2 MiB-aligned range around `addr` with one block, if it lies
+// in a heap section and nothing in it is mapped yet.
+static bool map_huge_page(struct pgdir *pd, struct section *st, u64 addr) {
+  u64 va = addr & ~(HUGE_PAGE_SIZE - 1);
+  if (!(st->flags & ST_HEAP) || va < st->begin ||
+      va + HUGE_PAGE_SIZE > st->end ||
+      left_page_cnt() <= REVERSED_PAGES + (1 << HUGE_PAGE_ORDER)) {
+    return false;
+  }
+  void *block = kalloc_pages(HUGE_PAGE_ORDER);
+  if (block == NULL) {
+    return false;
+  }
+  memset(block, 0, HUGE_PAGE_SIZE);
+  if (!vmmap_block(pd, va, block, PTE_USER_BLOCK | PTE_RW)) {
+    kfree_pages(block, HUGE_PAGE_ORDER);
+    return false;
+  }
+  __atomic_fetch_add(&fault_around_stat.blocks, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+static void fault_around(struct pgdir *pd, struct section *st, u64 addr,
+                         bool write) {
+  if (write && map_huge_page(pd, st, addr)) {
+    return;
+  }
+  map_anonymous_page(pd, addr, write);
+  __atomic_fetch_add(&fault_around_stat.faults, 1, __ATOMIC_RELAXED);
+  if (write) {
+    return;
+  }
+  u64 begin, end;
+  fault_window(st, addr, fault_around_pages, &begin, &end);
+  PTEntriesPtr pte_p = get_pte(pd, begin, false);
+  u64 mapped = 0;
+  for (u64 va = begin; pte_p != NULL && va < end; va += PAGE_SIZE, pte_p++) {
+    if (*pte_p == 0) {
+      set_pte(pte_p, K2P(get_zero_page()) | PTE_USER_DATA | PTE_RO | PTE_VALID);
+      mapped++;
     }
   }
+  __atomic_fetch_add(&fault_around_stat.mapped, mapped, __ATOMIC_RELAXED);
+}
 
-  st->flags &= ~ST_SWAP;
+// Set the fault-around window to `pages` if it is in [1, FAULT_AROUND_MAX],
+// and print a record like the ones of kmemstat:
+//   faultaround pages= faults= mapped= blocks=
+// Returns the window in use.
+define_syscall(faultaround, i64 pages) {
+  if (pages >= 1 && pages <= FAULT_AROUND_MAX) {
+    fault_around_pages = pages;
+  }
+  printk("faultaround pages=%d faults=%llu mapped=%llu blocks=%llu\n",
+         fault_around_pages, fault_around_stat.faults, fault_around_stat.mapped,
+         fault_around_stat.blocks);
+  return fault_around_pages;
 }
 
 int pgfault(u64 iss) {
-  (void)iss;
+  // instruction aborts leave WnR clear.
+  bool write = iss & ESR_ISS_WNR;
   // printk("iss is %lld\n", iss);
   struct proc *p = thisproc();
   struct pgdir *pd = &p->pgdir;
   u64 addr = arch_get_far();
-  ListNode *section_head = &pd->section_head;
-  struct section *section = NULL;
-  // TODO
-  // addr find sectioin : begin ?
-  _for_in_list(p, section_head) {
-    if (p == section_head) {
-      continue;
-    }
-    struct section *section_p = container_of(p, struct section, stnode);
-    if (section_p->begin <= addr && section_p->end > addr) {
-      section = section_p;
-      break;
-    }
-  }
+  struct section *section = lookup_section(pd, addr);
   // printk("addr is %p\n", (void *)addr);
   if (section == NULL) {
     printk("no corresponding section\n");
@@ -209,56 +680,144 @@ int pgfault(u64 iss) {
   }
 
   PTEntriesPtr pte_p = get_pte(pd, addr, false);
+  if (pte_p == NULL &&
+      (lookup_pte(pd, addr) != NULL || lookup_block(pd, addr) != NULL)) {
+    // there was no memory to split the block it is in, or to copy a shared
+    // table on the way.
+    return -1;
+  }
 
   if (pte_p == NULL || *pte_p == 0) {
-    // swapin if need?
     // printk("pg fault:null lazy allocation\n");
-    if (section->flags & ST_SWAP) {
-      swapin(pd, section);
-    } else {
-      auto page = alloc_page_for_user();
-      vmmap(pd, addr, page, PTE_USER_DATA | PTE_RW);
+    if (write && (section->flags & ST_RO))
+      return -1;
+    fault_around(pd, section, addr, write);
+  } else if (is_swap_entry(*pte_p)) {
+    // printk("pg fault:swap in\n");
+    swapin_page(pd, section, addr);
+  } else if (!(*pte_p & AF_USED)) {
+    // the CLOCK hand has passed, or the page was read ahead, and the page is
+    // in use again.
+    if (*pte_p & PTE_SWAP_RA) {
+      __atomic_fetch_add(&swap_readahead_stat.hits, 1, __ATOMIC_RELAXED);
+      *pte_p &= ~PTE_SWAP_RA;
     }
+    *pte_p |= AF_USED;
   } else if (*pte_p & PTE_RO) {
     // printk("pg fault: COW\n");
-    kfree_page((void *)P2K(PTE_ADDRESS(*pte_p)));
-    auto page = alloc_page_for_user();
-    vmmap(pd, addr, page, PTE_USER_DATA | PTE_RW);
-    // all zero page no need to memcpy
-
-  } else if (!(*pte_p & PTE_VALID)) {
-    if (section->flags & ST_SWAP) {
-      // printk("pg fault:swap in\n");
-      swapin(pd, section);
+    if (section->flags & ST_RO)
+      return -1;
+    auto old = (void *)P2K(PTE_ADDRESS(*pte_p));
+    if (page_ref_cnt(old) == 1) {
+      // the other sharers are gone, so the page can be written in place.
+      *pte_p &= ~PTE_RO;
     } else {
-      // printk("pg fault:invalid lazy allocation\n");
-
-      auto page = alloc_page_for_user();
+      void *page;
+      if (is_zero_page(old)) {
+        page = alloc_zeroed_page_for_user();
+      } else {
+        page = alloc_page_for_user();
+        memcpy(page, old, PAGE_SIZE);
+      }
       vmmap(pd, addr, page, PTE_USER_DATA | PTE_RW);
+      kfree_page(old);
     }
-
   } else {
     return -1;
   }
-  arch_tlbi_vmalle1is();
+  // other pages that were mapped were not valid, so they cannot be cached.
+  tlbi_page(pd, addr);
 
   return 0;
 }
 
+static void free_entry(PTEntriesPtr pte, u64 va, bool block, bool shared,
+                       void *arg) {
+  (void)va;
+  PTEntry entry = *pte;
+  if (shared) {
+    // the entry is left as it is for the forked copy. Blocks and swapped out
+    // pages are never shared, and cow_range took a reference to the page for
+    // each of them.
+    if (entry & PTE_VALID)
+      unmap_batch_add(arg, (void *)P2K(PTE_ADDRESS(entry)));
+    return;
+  }
+  set_pte(pte, 0);
+  if (block) {
+    unmap_batch_add_block(arg, (void *)P2K(PTE_ADDRESS(entry)));
+  } else if (is_swap_entry(entry)) {
+    release_swap_entry(entry);
+  } else {
+    unmap_batch_add(arg, (void *)P2K(PTE_ADDRESS(entry)));
+  }
+}
+
+// Drop the sections of `pd` and what is mapped in them. Only the tables and
+// entries that are populated are visited, so it takes time in proportion to
+// what is mapped rather than to the size of the sections.
 void free_sections(struct pgdir *pd) {
+  struct unmap_batch b = {.pd = pd};
+  detach_from_list(&reclaim_lock, &pd->reclaim_node);
+  // wait for reclaim to be done with it.
+  _acquire_spinlock(&pd->lock);
+  _release_spinlock(&pd->lock);
   while (!_empty_list(&pd->section_head)) {
     auto p = pd->section_head.next;
     auto section = container_of(p, struct section, stnode);
+    for_each_live_pte(pd, PAGE_BASE(section->begin), section->end, free_entry,
+                      &b);
+    _detach_from_list(p);
+    kmem_cache_free(section_cache, section);
+  }
+  pd->section_tree.rb_node = NULL;
+  pd->last_section = NULL;
+  pd->heap = NULL;
+  // the pages must not be reachable once they are freed.
+  tlbi_pgdir(pd);
+  unmap_batch_free(&b);
+}
 
-    for (auto addr = section->begin; addr < section->end; addr += PAGE_SIZE) {
-      PTEntriesPtr pte_p = get_pte(pd, addr, FALSE);
-      if (pte_p != NULL && !(*pte_p & PTE_VALID) && *pte_p != 0) {
-        release_8_blocks(*pte_p >> 12);
-      } else if (pte_p != NULL) {
-        kfree_page((void *)P2K(PTE_ADDRESS(*pte_p)));
-      }
+// Get `src` ready to share its tables with a forked copy. Swapped out pages
+// and blocks cannot be shared, so the pages are brought back and the blocks
+// split. Returns false if there is no memory for a table.
+bool prepare_copy_sections(struct pgdir *src) {
+  _for_in_list(p, &src->section_head) {
+    if (p == &src->section_head) {
+      continue;
     }
-    _detach_from_list(p);
-    kfree(section);
+    auto section = container_of(p, struct section, stnode);
+    if (section->flags & ST_FILE) {
+      continue;
+    }
+    swapin(src, section);
+    if (!split_blocks(src, PAGE_BASE(section->begin), section->end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Copy the sections of `src` into `dst`, which shares the tables of `src`,
+// and make the pages in them copy-on-write. Returns false if there is no
+// memory for a section; the ones copied so far are left in `dst` and freed
+// with it.
+bool copy_sections(struct pgdir *dst, struct pgdir *src) {
+  insert_into_list(&reclaim_lock, &reclaim_list, &dst->reclaim_node);
+  _for_in_list(p, &src->section_head) {
+    if (p == &src->section_head) {
+      continue;
+    }
+    auto section = container_of(p, struct section, stnode);
+    struct section *copy = kmem_cache_alloc(section_cache);
+    if (copy == NULL) {
+      return false;
+    }
+    copy->flags = section->flags;
+    copy->begin = section->begin;
+    copy->end = section->end;
+    add_section(dst, copy);
+    cow_range(src, section->begin, section->end);
   }
+  return true;
 }
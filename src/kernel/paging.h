@@ -6,28 +6,49 @@
 #include <kernel/pt.h>
 
 #define ST_FILE 1
-#define ST_SWAP (1 << 1)
 #define ST_RO (1 << 2)
 #define ST_HEAP (1 << 3)
 #define ST_TEXT (ST_FILE | ST_RO)
 #define ST_DATA ST_FILE
 #define ST_BSS ST_FILE
 
+// default and largest number of pages mapped by one anonymous fault.
+#define FAULT_AROUND_PAGES 16
+#define FAULT_AROUND_MAX N_PTE_PER_TABLE
+
+// pages one turn of the CLOCK hand looks at in a page table.
+#define CLOCK_SCAN_PAGES 512
+// a page table that has not run for this long is worth one more share of
+// its cold pages to reclaim, up to RECLAIM_IDLE_MAX more.
+#define RECLAIM_IDLE_MS 100
+#define RECLAIM_IDLE_MAX 8
+// pages taken out of a page table before they are written to swap.
+#define SWAP_BATCH 16
+// default and largest number of pages read by one swap-in fault.
+#define SWAP_READAHEAD_PAGES 8
+#define SWAP_READAHEAD_MAX SWAP_BATCH
+
 struct section {
   u64 flags;
   SleepLock sleeplock;
   u64 begin;
   u64 end;
   ListNode stnode;
+  struct rb_node_ stree;
   // struct file* fp;
   // u64 offset;
 };
 
 WARN_RESULT void *alloc_page_for_user();
+WARN_RESULT void *alloc_zeroed_page_for_user();
 int pgfault(u64 iss);
 void swapout(struct pgdir *pd, struct section *st);
 void swapin(struct pgdir *pd, struct section *st);
-void *alloc_page_for_user();
-void init_sections(ListNode *section_head);
+int clock_reclaim(int n);
+void init_section_cache();
+void init_sections(struct pgdir *pd);
+struct section *lookup_section(struct pgdir *pd, u64 va);
 void free_sections(struct pgdir *pd);
+WARN_RESULT bool prepare_copy_sections(struct pgdir *src);
+WARN_RESULT bool copy_sections(struct pgdir *dst, struct pgdir *src);
 u64 sbrk(i64 size);
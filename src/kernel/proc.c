@@ -10,16 +10,19 @@
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
+#include <kernel/syscall.h>
 
 struct proc root_proc;
 extern struct container root_container;
 
 void kernel_entry();
 void proc_entry();
+void trap_return();
 static SpinLock plock;
 SpinLock pid_lock;
 
 static struct pid_pool global_pids;
+static CacheNode *proc_cache;
 
 define_early_init(plock) {
   init_spinlock(&plock);
@@ -143,7 +146,7 @@ int wait(int *exitcode, int *pid) {
       child->container->pids.freelist[--child->container->pids.avail] = lpid;
       _release_spinlock(&child->container->pid_lock);
       _detach_from_list(&child->ptnode);
-      kfree(child);
+      kmem_cache_free(proc_cache, child);
       // printk("cpu %d %d wait return\n", cpuid(), this->pid);
       _release_spinlock(&plock);
       return lpid;
@@ -242,27 +245,56 @@ void init_proc(struct proc *p) {
   _release_spinlock(&plock);
 }
 
+// Returns NULL if there is no memory for the proc.
 struct proc *create_proc() {
-  struct proc *p = kalloc(sizeof(struct proc));
+  struct proc *p = kmem_cache_alloc(proc_cache);
+  if (p == NULL)
+    return NULL;
   init_proc(p);
   return p;
 }
 
+// undo create_proc for a proc that never started.
+static void free_unstarted_proc(struct proc *p) {
+  free_pgdir(&p->pgdir);
+  if (p->kstack != NULL)
+    kfree_page(p->kstack);
+  _acquire_spinlock(&pid_lock);
+  global_pids.freelist[--global_pids.avail] = p->pid;
+  _release_spinlock(&pid_lock);
+  kmem_cache_free(proc_cache, p);
+}
+
+// Create a child of the current process that returns to user space from the
+// same trap as it, with a copy-on-write copy of its address space. Returns the
+// local pid of the child, or -1 if there is no memory for it.
+int fork() {
+  auto this = thisproc();
+  auto child = create_proc();
+  if (child == NULL)
+    return -1;
+  if (child->kstack == NULL || !copy_pgdir(&child->pgdir, &this->pgdir)) {
+    free_unstarted_proc(child);
+    return -1;
+  }
+  *child->ucontext = *this->ucontext;
+  child->ucontext->x[0] = 0;
+  set_parent_to_this(child);
+  set_container_to_this(child);
+  return start_proc(child, trap_return, 0);
+}
+
+define_syscall(fork) { return fork(); }
+
 define_init(root_proc) {
+  init_section_cache();
+  proc_cache =
+      kmem_cache_create("proc", sizeof(struct proc), CACHE_LINE_SIZE, NULL);
   init_proc(&root_proc);
   root_proc.parent = &root_proc;
   start_proc(&root_proc, kernel_entry, 123456);
 }
 
-struct proc *get_offline_proc() {
-  auto offline_proc = dfs(&root_proc, 0, true);
-  if (offline_proc == NULL) {
-    printk("no offline in proc tree\n");
-    PANIC();
-  }
-  return offline_proc;
-}
-
 // void yield() {
 //     // TODO: lab7 container
 //     // Give up cpu resources and switch to the scheduler
@@ -46,7 +46,7 @@ struct proc {
 WARN_RESULT struct proc *create_proc();
 void set_parent_to_this(struct proc *);
 int start_proc(struct proc *, void (*entry)(u64), u64 arg);
+WARN_RESULT int fork();
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode, int *pid);
 WARN_RESULT int kill(int pid);
-struct proc *get_offline_proc();
@@ -6,81 +6,326 @@
 #include "kernel/sched.h"
 #include <aarch64/intrinsic.h>
 #include <common/string.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
 #include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/pt.h>
 
-PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
-  // TODO
-  // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
-  // If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or
-  // return NULL if false. THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY
-  // PTE.
-  auto pt0 = pgdir->pt;
-  if (pt0 == NULL) {
-    if (!alloc)
-      return NULL;
-    pt0 = (PTEntriesPtr)kalloc_page();
-    pgdir->pt = pt0;
-    memset(pt0, 0, PAGE_SIZE);
+// Tables below the root may be shared between a page table and its forked
+// copies, one reference each. A shared table is read-only: it is copied by the
+// first of them that looks up an entry in it. share_lock keeps the reference
+// counts of tables in step with their contents.
+static SpinLock share_lock;
+
+define_early_init(share_lock) { init_spinlock(&share_lock); }
+
+// Every page table gets an 8-bit ASID when it is attached, so the TLB can
+// hold the entries of several of them and a switch flushes nothing. ASIDs are
+// handed out in generations: pgdir->asid keeps the generation in the bits
+// above ASID_BITS, and is stale once the generation has moved on. When a
+// generation runs out, a new one starts with only the ASIDs still running
+// kept, and every CPU flushes its TLB before it attaches a table again.
+#define ASID_BITS 8
+#define NUM_ASIDS (1 << ASID_BITS)
+#define ASID_MASK ((u64)NUM_ASIDS - 1)
+
+static SpinLock asid_lock;
+static u64 asid_generation = NUM_ASIDS;
+static u64 asid_map[NUM_ASIDS / 64];
+static u64 active_asid[NCPU];
+static bool tlb_flush_pending[NCPU];
+
+define_early_init(asid_lock) {
+  init_spinlock(&asid_lock);
+  // ASID 0 goes with invalid_pt.
+  asid_map[0] = 1;
+}
+
+static void new_asid_generation() {
+  asid_generation += NUM_ASIDS;
+  memset(asid_map, 0, sizeof(asid_map));
+  asid_map[0] = 1;
+  for (int i = 0; i < NCPU; i++) {
+    u64 asid = active_asid[i] & ASID_MASK;
+    asid_map[asid / 64] |= 1ull << (asid % 64);
+    tlb_flush_pending[i] = true;
   }
-  PTEntriesPtr pt1 = NULL;
-  if (pt0[VA_PART0(va)] == NULL || !(pt0[VA_PART0(va)] & PTE_VALID)) {
-    if (!alloc)
+}
+
+// the ASID of `pgdir` in the current generation. asid_lock must be held.
+static u64 get_asid(struct pgdir *pgdir) {
+  u64 asid = pgdir->asid;
+  if ((asid & ~ASID_MASK) == asid_generation)
+    return asid;
+  // keep the ASID of a table that was running when the generation ended.
+  for (int i = 0; asid != 0 && i < NCPU; i++) {
+    if (active_asid[i] == asid)
+      return asid_generation | (asid & ASID_MASK);
+  }
+  for (int round = 0; round < 2; round++) {
+    for (u64 i = 1; i < NUM_ASIDS; i++) {
+      if (!(asid_map[i / 64] & (1ull << (i % 64)))) {
+        asid_map[i / 64] |= 1ull << (i % 64);
+        return asid_generation | i;
+      }
+    }
+    new_asid_generation();
+  }
+  PANIC();
+}
+
+// the ASID that the entries of `pgdir` may be cached with.
+static u64 pgdir_asid(struct pgdir *pgdir) { return pgdir->asid & ASID_MASK; }
+
+// Invalidate the cached entries of [begin, end) in `pgdir`. Long ranges drop
+// the whole ASID instead of going page by page.
+void tlbi_range(struct pgdir *pgdir, u64 begin, u64 end) {
+  if (end - begin > TLBI_RANGE_MAX * PAGE_SIZE) {
+    arch_tlbi_aside1is(pgdir_asid(pgdir));
+    return;
+  }
+  for (u64 va = begin; va < end; va += PAGE_SIZE)
+    arch_tlbi_vae1is(va, pgdir_asid(pgdir));
+}
+
+void tlbi_page(struct pgdir *pgdir, u64 va) {
+  arch_tlbi_vae1is(va, pgdir_asid(pgdir));
+}
+
+void tlbi_pgdir(struct pgdir *pgdir) { arch_tlbi_aside1is(pgdir_asid(pgdir)); }
+
+// the page table attached on each CPU. It is the one that is online there.
+static struct pgdir *attached_pgdir[NCPU];
+
+static bool is_table(PTEntry pte) {
+  return (pte & PTE_TABLE) == PTE_TABLE;
+}
+
+static bool is_block(PTEntry pte) {
+  return (pte & PTE_TABLE) == PTE_BLOCK;
+}
+
+static void set_pt_range(PTEntriesPtr pt, u16 cnt, u16 lo, u16 hi) {
+  auto page = virt_to_page(pt);
+  page->pte_cnt = cnt;
+  page->pte_lo = lo;
+  page->pte_hi = hi;
+}
+
+// a new, empty table, or NULL if there is no memory for it.
+static PTEntriesPtr alloc_pt() {
+  auto pt = (PTEntriesPtr)kalloc_zeroed_page();
+  if (pt != NULL)
+    set_pt_range(pt, 0, 0, 0);
+  return pt;
+}
+
+void set_pte(PTEntriesPtr pte, PTEntry entry) {
+  if ((*pte == 0) != (entry == 0)) {
+    auto pt = (PTEntriesPtr)PAGE_BASE((u64)pte);
+    auto page = virt_to_page(pt);
+    u16 i = (u16)(pte - pt);
+    if (entry == 0) {
+      if (--page->pte_cnt == 0)
+        page->pte_lo = page->pte_hi = 0;
+    } else if (page->pte_cnt++ == 0) {
+      page->pte_lo = i;
+      page->pte_hi = i + 1;
+    } else {
+      page->pte_lo = MIN(page->pte_lo, i);
+      page->pte_hi = MAX(page->pte_hi, (u16)(i + 1));
+    }
+  }
+  *pte = entry;
+}
+
+// Large heap ranges may be mapped by 2 MiB level-2 blocks. A block is only
+// ever in a private table, and it is split back into pages whenever a single
+// entry in it is asked for. Returns NULL, with the block left as it is, if
+// there is no memory for the table.
+static PTEntriesPtr split_block(struct pgdir *pgdir, PTEntry *pte) {
+  auto block = (void *)P2K(PTE_ADDRESS(*pte));
+  u64 flags = (PTE_FLAGS(*pte) & ~PTE_TABLE) | PTE_PAGE;
+  auto pt = (PTEntriesPtr)kalloc_page();
+  if (pt == NULL)
+    return NULL;
+  for (int i = 0; i < N_PTE_PER_TABLE; i++)
+    pt[i] = (K2P(block) + (u64)i * PAGE_SIZE) | flags;
+  set_pt_range(pt, N_PTE_PER_TABLE, 0, N_PTE_PER_TABLE);
+  split_pages(block, HUGE_PAGE_ORDER);
+  // break before make.
+  *pte = 0;
+  arch_tlbi_aside1is(pgdir_asid(pgdir));
+  *pte = K2P(pt) | PTE_TABLE;
+  return pt;
+}
+
+// whether `pt` has a reference from more than one page table.
+static bool pt_shared(PTEntriesPtr pt) { return page_ref_cnt(pt) > 1; }
+
+// the table that `*pte` points to at `level`, copied first if it is shared.
+// Returns NULL, with the table still shared, if there is no memory for the
+// copy.
+static PTEntriesPtr unshare_pt(struct pgdir *pgdir, PTEntry *pte, int level) {
+  auto pt = (PTEntriesPtr)P2K(PTE_ADDRESS(*pte));
+  if (!pt_shared(pt))
+    return pt;
+  _acquire_spinlock(&share_lock);
+  if (pt_shared(pt)) {
+    auto copy = (PTEntriesPtr)kalloc_page();
+    if (copy == NULL) {
+      _release_spinlock(&share_lock);
       return NULL;
-    pt1 = (PTEntriesPtr)kalloc_page();
-    memset(pt1, 0, PAGE_SIZE);
-    pt0[VA_PART0(va)] = K2P(pt1) | PTE_TABLE;
-  } else {
-    pt1 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt0[VA_PART0(va)]));
+    }
+    memcpy(copy, pt, PAGE_SIZE);
+    auto page = virt_to_page(pt);
+    set_pt_range(copy, page->pte_cnt, page->pte_lo, page->pte_hi);
+    // the pages in a leaf table are accounted for by cow_range.
+    if (level < 3) {
+      for (int i = page->pte_lo; i < page->pte_hi; i++) {
+        if (is_table(copy[i]))
+          get_page((void *)P2K(PTE_ADDRESS(copy[i])));
+      }
+    }
+    kfree_page(pt);
+    *pte = K2P(copy) | PTE_TABLE;
+    // the walk cache must not keep the old table, which another sharer may
+    // free.
+    arch_tlbi_aside1is(pgdir_asid(pgdir));
+    pt = copy;
   }
-  PTEntriesPtr pt2 = NULL;
-  if (pt1[VA_PART1(va)] == NULL || !(pt1[VA_PART1(va)] & PTE_VALID)) {
+  _release_spinlock(&share_lock);
+  return pt;
+}
+
+// the table at `level` that `*pte` points to. Returns NULL if there is none
+// and `alloc` is false, or if there is no memory for what it takes.
+static PTEntriesPtr next_pt(struct pgdir *pgdir, PTEntry *pte, int level,
+                            bool alloc, bool unshare) {
+  if (*pte == NULL || !(*pte & PTE_VALID)) {
     if (!alloc)
       return NULL;
-    pt2 = (PTEntriesPtr)kalloc_page();
-    memset(pt2, 0, PAGE_SIZE);
-    pt1[VA_PART1(va)] = K2P(pt2) | PTE_TABLE;
-  } else {
-    pt2 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt1[VA_PART1(va)]));
+    auto pt = alloc_pt();
+    if (pt != NULL)
+      set_pte(pte, K2P(pt) | PTE_TABLE);
+    return pt;
   }
-  PTEntriesPtr pt3 = NULL;
-  if (pt2[VA_PART2(va)] == NULL || !(pt2[VA_PART2(va)] & PTE_VALID)) {
+  if (is_block(*pte))
+    return unshare ? split_block(pgdir, pte) : NULL;
+  if (unshare)
+    return unshare_pt(pgdir, pte, level);
+  return (PTEntriesPtr)P2K(PTE_ADDRESS(*pte));
+}
+
+static PTEntriesPtr walk(struct pgdir *pgdir, u64 va, bool alloc,
+                         bool unshare) {
+  auto pt0 = pgdir->pt;
+  if (pt0 == NULL) {
     if (!alloc)
       return NULL;
-    pt3 = (PTEntriesPtr)kalloc_page();
-    memset(pt3, 0, PAGE_SIZE);
-    pt2[VA_PART2(va)] = K2P(pt3) | PTE_TABLE;
-  } else {
-    pt3 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt2[VA_PART2(va)]));
+    pt0 = alloc_pt();
+    if (pt0 == NULL)
+      return NULL;
+    pgdir->pt = pt0;
   }
+  auto pt1 = next_pt(pgdir, &pt0[VA_PART0(va)], 1, alloc, unshare);
+  if (pt1 == NULL)
+    return NULL;
+  auto pt2 = next_pt(pgdir, &pt1[VA_PART1(va)], 2, alloc, unshare);
+  if (pt2 == NULL)
+    return NULL;
+  auto pt3 = next_pt(pgdir, &pt2[VA_PART2(va)], 3, alloc, unshare);
+  if (pt3 == NULL)
+    return NULL;
   return &pt3[VA_PART3(va)];
 }
 
+PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
+  // TODO
+  // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
+  // If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or
+  // return NULL if false. THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY
+  // PTE.
+  // Also returns NULL if there is no memory for a table on the way to `va`,
+  // to split the block it is in or to copy a shared table.
+  return walk(pgdir, va, alloc, true);
+}
+
+// like get_pte(pgdir, va, false), but the entry may be in a table shared with
+// a forked page table, so it must only be read. Returns NULL for a page in a
+// block.
+PTEntriesPtr lookup_pte(struct pgdir *pgdir, u64 va) {
+  return walk(pgdir, va, false, false);
+}
+
+// the block descriptor that maps `va`, or NULL if there is none.
+PTEntriesPtr lookup_block(struct pgdir *pgdir, u64 va) {
+  if (pgdir->pt == NULL)
+    return NULL;
+  auto pt1 = next_pt(pgdir, &pgdir->pt[VA_PART0(va)], 1, false, false);
+  if (pt1 == NULL)
+    return NULL;
+  auto pt2 = next_pt(pgdir, &pt1[VA_PART1(va)], 2, false, false);
+  if (pt2 == NULL)
+    return NULL;
+  auto pte = &pt2[VA_PART2(va)];
+  return is_block(*pte) ? pte : NULL;
+}
+
+// Whether the entry of `va` is shared with a forked copy, because a table on
+// the way to it is. Only the level-1 tables take a reference when a page
+// table is copied, so the tables below a shared one are shared too however
+// many references they have.
+bool shared_pte(struct pgdir *pgdir, u64 va) {
+  if (pgdir->pt == NULL)
+    return false;
+  auto pt = pgdir->pt;
+  PTEntry *pte = &pt[VA_PART0(va)];
+  for (int level = 1; level <= 3; level++) {
+    pt = next_pt(pgdir, pte, level, false, false);
+    if (pt == NULL)
+      return false;
+    if (pt_shared(pt))
+      return true;
+    pte = &pt[level == 1 ? VA_PART1(va) : VA_PART2(va)];
+  }
+  return false;
+}
+
+// get_pte for the functions that cannot fail. Running out of memory for a
+// table, to split a block or to copy a shared table is fatal to them.
+static PTEntriesPtr must_get_pte(struct pgdir *pd, u64 va, bool alloc) {
+  auto pte = get_pte(pd, va, alloc);
+  if (pte == NULL && (alloc || lookup_pte(pd, va) != NULL ||
+                      lookup_block(pd, va) != NULL)) {
+    printk("no memory for a page table\n");
+    PANIC();
+  }
+  return pte;
+}
+
 void init_pgdir(struct pgdir *pgdir) {
   memset(pgdir, 0, sizeof(struct pgdir));
   init_spinlock(&pgdir->lock);
   init_list_node(&pgdir->section_head);
-  init_sections(&pgdir->section_head);
+  init_sections(pgdir);
   // pgdir->pt = NULL;
 
   ASSERT(get_pte(pgdir, 0, true));
 }
 
-void free_pt_r(PTEntriesPtr pt, int num) {
-  if (num == 3) {
-    if (pt != NULL) {
-      kfree_page((PTEntriesPtr)P2K(PTE_ADDRESS((PTEntry)pt)));
-    }
-    return;
-  }
-  if (pt != NULL) {
-    for (int i = 0; i < N_PTE_PER_TABLE; i++) {
-      auto ptin = num == 0 ? pt : (PTEntriesPtr)P2K(PTE_ADDRESS((PTEntry)pt));
-      free_pt_r((PTEntriesPtr)(ptin[i]), num + 1);
+// drop a reference to a table at `level`, and to the tables below it when it
+// was the last one. share_lock must be held.
+static void put_pt(PTEntriesPtr pt, int level, struct page_batch *b) {
+  if (level < 3 && page_ref_cnt(pt) == 1) {
+    auto page = virt_to_page(pt);
+    for (int i = page->pte_lo; i < page->pte_hi; i++) {
+      if (is_table(pt[i]))
+        put_pt((PTEntriesPtr)P2K(PTE_ADDRESS(pt[i])), level + 1, b);
     }
-    kfree_page((PTEntriesPtr)P2K(PTE_ADDRESS((PTEntry)pt)));
   }
+  page_batch_add(b, pt);
 }
 
 void free_pgdir(struct pgdir *pgdir) {
@@ -91,33 +336,303 @@ void free_pgdir(struct pgdir *pgdir) {
   if (pgdir->pt == NULL) {
     return;
   }
-  free_pt_r(pgdir->pt, 0);
+  // the ASID stays with pgdir, so none of its entries may be left.
+  arch_tlbi_aside1is(pgdir_asid(pgdir));
+  bool t = _arch_disable_trap();
+  if (attached_pgdir[cpuid()] == pgdir) {
+    attached_pgdir[cpuid()] = NULL;
+    pgdir->online = false;
+  }
+  if (t)
+    ASSERT(!_arch_enable_trap());
+  struct page_batch b = {0};
+  _acquire_spinlock(&share_lock);
+  put_pt(pgdir->pt, 0, &b);
+  // the references must be gone before another sharer checks them.
+  page_batch_flush(&b);
+  _release_spinlock(&share_lock);
+  pgdir->pt = NULL;
+}
+
+// Map the HUGE_PAGE_SIZE-aligned `va` to the block `ka` from
+// kalloc_pages(HUGE_PAGE_ORDER) with one block descriptor. Fails if a page
+// in the range is already mapped, or if there is no memory for the tables.
+bool vmmap_block(struct pgdir *pd, u64 va, void *ka, u64 flags) {
+  ASSERT(va % HUGE_PAGE_SIZE == 0);
+  if (pd->pt == NULL && (pd->pt = alloc_pt()) == NULL)
+    return false;
+  auto pt1 = next_pt(pd, &pd->pt[VA_PART0(va)], 1, true, true);
+  if (pt1 == NULL)
+    return false;
+  auto pt2 = next_pt(pd, &pt1[VA_PART1(va)], 2, true, true);
+  if (pt2 == NULL)
+    return false;
+  PTEntry *pte = &pt2[VA_PART2(va)];
+  if (*pte != NULL && (*pte & PTE_VALID)) {
+    if (!is_table(*pte))
+      return false;
+    auto pt3 = (PTEntriesPtr)P2K(PTE_ADDRESS(*pte));
+    if (virt_to_page(pt3)->pte_cnt != 0)
+      return false;
+    // the empty leaf table is replaced by the block.
+    set_pte(pte, 0);
+    arch_tlbi_aside1is(pgdir_asid(pd));
+    struct page_batch b = {0};
+    _acquire_spinlock(&share_lock);
+    put_pt(pt3, 3, &b);
+    page_batch_flush(&b);
+    _release_spinlock(&share_lock);
+  }
+  set_pte(pte, K2P(ka) | flags | PTE_VALID);
+  return true;
 }
 
+// Make the pages mapped in [begin, end) copy-on-write: they become read-only
+// and get one more reference, for a forked copy of the page table. Leaf
+// tables that are already shared only hold read-only entries, so they can be
+// updated in place. Shared pages are tracked one by one, so the blocks in the
+// range must have been split by split_blocks.
+void cow_range(struct pgdir *pgdir, u64 begin, u64 end) {
+  for (u64 va = begin; va < end;) {
+    u64 next = (va + N_PTE_PER_TABLE * PAGE_SIZE) &
+               ~(N_PTE_PER_TABLE * PAGE_SIZE - 1);
+    auto pte = lookup_pte(pgdir, va);
+    if (pte == NULL) {
+      va = next;
+      continue;
+    }
+    for (; va < end && va < next; va += PAGE_SIZE, pte++) {
+      if (*pte & PTE_VALID) {
+        *pte |= PTE_RO;
+        get_page((void *)P2K(PTE_ADDRESS(*pte)));
+      }
+    }
+  }
+}
+
+// Turn the empty `dst` into a copy-on-write copy of `src`, the page table
+// of the current process. Only the root table is copied; the tables below it
+// and the user pages are shared until they are written. Returns false if
+// there is no memory for it, with what was copied left in `dst` for
+// free_pgdir.
+bool copy_pgdir(struct pgdir *dst, struct pgdir *src) {
+  free_pgdir(dst);
+  if (!prepare_copy_sections(src) || (dst->pt = alloc_pt()) == NULL)
+    return false;
+  if (src->pt != NULL) {
+    _acquire_spinlock(&share_lock);
+    auto page = virt_to_page(src->pt);
+    for (int i = page->pte_lo; i < page->pte_hi; i++) {
+      if (is_table(src->pt[i])) {
+        get_page((void *)P2K(PTE_ADDRESS(src->pt[i])));
+        set_pte(&dst->pt[i], src->pt[i]);
+      }
+    }
+    _release_spinlock(&share_lock);
+  }
+  bool ok = copy_sections(dst, src);
+  // the pages of src have just become read-only.
+  arch_tlbi_aside1is(pgdir_asid(src));
+  return ok;
+}
+
+// Attach `pgdir` to this CPU, and mark it online in place of the one that was
+// attached before. Reclaim only touches page tables that are offline.
 void attach_pgdir(struct pgdir *pgdir) {
   extern PTEntries invalid_pt;
-  _acquire_spinlock(&thisproc()->pgdir.lock);
-  thisproc()->pgdir.online = false;
-  // if (_try_acquire_spinlock(&thisproc()->pgdir.lock)) {
-  //   // printk("pgdir no online yet\n");
-  // } else {
-  //   // printk("pgdir is online,proc %d\n", thisproc()->pid);
-  // }
-  _release_spinlock(&thisproc()->pgdir.lock);
-
+  bool t = _arch_disable_trap();
+  auto old = attached_pgdir[cpuid()];
+  if (old != NULL && old != pgdir) {
+    _acquire_spinlock(&old->lock);
+    old->online = false;
+    old->last_run = get_timestamp();
+    _release_spinlock(&old->lock);
+  }
+  attached_pgdir[cpuid()] = NULL;
   if (pgdir->pt) {
+    // reclaim may be in the middle of it.
     _acquire_spinlock(&pgdir->lock);
-    pgdir->online = TRUE;
-    _release_spinlock(&thisproc()->pgdir.lock);
-
-    arch_set_ttbr0(K2P(pgdir->pt));
+    pgdir->online = true;
+    _release_spinlock(&pgdir->lock);
+    attached_pgdir[cpuid()] = pgdir;
+    _acquire_spinlock(&asid_lock);
+    pgdir->asid = get_asid(pgdir);
+    active_asid[cpuid()] = pgdir->asid;
+    if (tlb_flush_pending[cpuid()]) {
+      tlb_flush_pending[cpuid()] = false;
+      arch_tlbi_vmalle1();
+    }
+    _release_spinlock(&asid_lock);
+    arch_set_ttbr0_asid(K2P(pgdir->pt), pgdir_asid(pgdir));
   } else {
-    arch_set_ttbr0(K2P(&invalid_pt));
+    // nothing is ever cached with invalid_pt.
+    active_asid[cpuid()] = 0;
+    arch_set_ttbr0_asid(K2P(&invalid_pt), 0);
   }
+  if (t)
+    ASSERT(!_arch_enable_trap());
 }
 
 // 在给定的页表上，建立虚拟地址到物理地址的映射
 void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags) {
 
-  *get_pte(pd, va, true) = K2P(ka) | flags | PTE_VALID; // or PTE_KERNEL_DEVICE?
+  set_pte(must_get_pte(pd, va, true), K2P(ka) | flags | PTE_VALID);
 };
+
+// The range functions below walk to each leaf table once and then step
+// through its entries, instead of walking from the root for every page.
+// Ranges are [begin, end) and page aligned.
+
+// the end of the leaf table that maps `va`, or `end` if that is sooner.
+static u64 leaf_end(u64 va, u64 end) {
+  u64 next = (va & ~(HUGE_PAGE_SIZE - 1)) + HUGE_PAGE_SIZE;
+  return MIN(next, end);
+}
+
+// call `fn(pte, va, arg)` on the entry of each page in [begin, end) that has
+// a leaf table. The entries may be written.
+void for_each_pte(struct pgdir *pd, u64 begin, u64 end,
+                  void (*fn)(PTEntriesPtr pte, u64 va, void *arg), void *arg) {
+  for (u64 va = begin; va < end;) {
+    u64 next = leaf_end(va, end);
+    auto pte = get_pte(pd, va, false);
+    for (; pte != NULL && va < next; va += PAGE_SIZE, pte++)
+      fn(pte, va, arg);
+    va = next;
+  }
+}
+
+// the range that one entry of a table at `level` maps.
+#define PT_ENTRY_SIZE(level) (PAGE_SIZE << (9 * (3 - (level))))
+
+// `shared` is set when a table above `pt` is shared with a forked copy.
+static void walk_live(PTEntriesPtr pt, int level, bool shared, u64 base,
+                      u64 begin, u64 end,
+                      void (*fn)(PTEntriesPtr pte, u64 va, bool block,
+                                 bool shared, void *arg),
+                      void *arg) {
+  shared = shared || pt_shared(pt);
+  auto page = virt_to_page(pt);
+  u64 size = PT_ENTRY_SIZE(level);
+  u64 lo = page->pte_lo, hi = page->pte_hi;
+  if (begin > base)
+    lo = MAX(lo, (begin - base) / size);
+  hi = MIN(hi, (end - base + size - 1) / size);
+  for (u64 i = lo; i < hi; i++) {
+    if (pt[i] == 0)
+      continue;
+    u64 va = base + i * size;
+    if (level < 3 && is_table(pt[i]))
+      walk_live((PTEntriesPtr)P2K(PTE_ADDRESS(pt[i])), level + 1, shared, va,
+                begin, end, fn, arg);
+    else if (level == 3 || is_block(pt[i]))
+      fn(&pt[i], va, level < 3, shared, arg);
+  }
+}
+
+void for_each_live_pte(struct pgdir *pd, u64 begin, u64 end,
+                       void (*fn)(PTEntriesPtr pte, u64 va, bool block,
+                                  bool shared, void *arg),
+                       void *arg) {
+  if (pd->pt != NULL && begin < end)
+    walk_live(pd->pt, 0, false, 0, begin, end, fn, arg);
+}
+
+// Split the blocks in [begin, end) into pages. Returns false if there is no
+// memory for a table, with the blocks from there on left as they are.
+bool split_blocks(struct pgdir *pd, u64 begin, u64 end) {
+  for (u64 va = begin; va < end; va = leaf_end(va, end)) {
+    if (lookup_block(pd, va) != NULL && get_pte(pd, va, false) == NULL)
+      return false;
+  }
+  return true;
+}
+
+// map [va, va + size) to the physically contiguous [ka, ka + size).
+void vmmap_range(struct pgdir *pd, u64 va, void *ka, u64 size, u64 flags) {
+  for (u64 end = va + size; va < end;) {
+    u64 next = leaf_end(va, end);
+    auto pte = must_get_pte(pd, va, true);
+    for (; va < next; va += PAGE_SIZE, ka += PAGE_SIZE, pte++)
+      set_pte(pte, K2P(ka) | flags | PTE_VALID);
+  }
+}
+
+static void unmap_batch_flush(struct unmap_batch *b) {
+  tlbi_pgdir(b->pd);
+  unmap_batch_free(b);
+}
+
+void unmap_batch_add(struct unmap_batch *b, void *page) {
+  if (b->pages.cnt == PAGE_BATCH_SIZE)
+    unmap_batch_flush(b);
+  page_batch_add(&b->pages, page);
+}
+
+void unmap_batch_add_block(struct unmap_batch *b, void *block) {
+  if (b->blocks == UNMAP_BATCH_BLOCKS)
+    unmap_batch_flush(b);
+  b->block[b->blocks++] = block;
+}
+
+void unmap_batch_free(struct unmap_batch *b) {
+  page_batch_flush(&b->pages);
+  for (int i = 0; i < b->blocks; i++)
+    kfree_pages(b->block[i], HUGE_PAGE_ORDER);
+  b->blocks = 0;
+}
+
+// Clear the entries of [begin, end) and drop the pages they map. Entries that
+// are neither empty nor valid are passed to `release` first, if it is given.
+// Blocks that lie in the range are freed whole.
+void vmunmap_range(struct pgdir *pd, u64 begin, u64 end,
+                   void (*release)(PTEntry)) {
+  struct unmap_batch b = {.pd = pd};
+  for (u64 va = begin; va < end;) {
+    u64 next = leaf_end(va, end);
+    auto block = lookup_block(pd, va);
+    if (block != NULL && va % HUGE_PAGE_SIZE == 0 &&
+        next - va == HUGE_PAGE_SIZE) {
+      auto ka = (void *)P2K(PTE_ADDRESS(*block));
+      set_pte(block, 0);
+      unmap_batch_add_block(&b, ka);
+      va = next;
+      continue;
+    }
+    auto pte = must_get_pte(pd, va, false);
+    for (; pte != NULL && va < next; va += PAGE_SIZE, pte++) {
+      PTEntry entry = *pte;
+      set_pte(pte, 0);
+      if (entry & PTE_VALID) {
+        unmap_batch_add(&b, (void *)P2K(PTE_ADDRESS(entry)));
+      } else if (entry != 0 && release != NULL) {
+        release(entry);
+      }
+    }
+    va = next;
+  }
+  // the pages must not be reachable once they are freed.
+  tlbi_range(pd, begin, end);
+  unmap_batch_free(&b);
+}
+
+// Set the bits `set` and clear the bits `clear` in every valid entry of
+// [begin, end). Swap entries are left alone, and a page that is shared for
+// copy-on-write stays read-only.
+void vmprotect_range(struct pgdir *pd, u64 begin, u64 end, u64 set,
+                     u64 clear) {
+  for (u64 va = begin; va < end;) {
+    u64 next = leaf_end(va, end);
+    auto pte = must_get_pte(pd, va, false);
+    for (; pte != NULL && va < next; va += PAGE_SIZE, pte++) {
+      if (!(*pte & PTE_VALID))
+        continue;
+      u64 c = clear;
+      if (page_ref_cnt((void *)P2K(PTE_ADDRESS(*pte))) > 1)
+        c &= ~(u64)PTE_RO;
+      *pte = (*pte | set) & ~c;
+    }
+    va = next;
+  }
+  tlbi_range(pd, begin, end);
+}
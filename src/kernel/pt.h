@@ -2,16 +2,84 @@
 
 #include <aarch64/mmu.h>
 #include <common/list.h>
+#include <common/rbtree.h>
+#include <kernel/mem.h>
+
+// ranges longer than this many pages are invalidated by ASID, see tlbi_range.
+#define TLBI_RANGE_MAX 64
+
+struct section;
 
 struct pgdir {
   PTEntriesPtr pt;
   SpinLock lock;
   ListNode section_head;
+  struct rb_root_ section_tree; // the sections ordered by begin
+  struct section *last_section; // hit by the last lookup_section
+  struct section *heap;
+  u64 asid; // the ASID and its generation, set by attach_pgdir
+  ListNode reclaim_node; // on the list that the CLOCK hand goes round
+  u64 clock_hand;        // the next page the CLOCK hand looks at
   bool online;
+  u64 last_run; // when it last went offline
+  // The working set as reclaim sees it, under swap_lock: the private pages
+  // the CLOCK hand passed in its last round and how many of them had been
+  // accessed, the same for the round in progress, and the pages taken from it
+  // and faulted back, halved every round. See reclaim_score.
+  u32 resident, active;
+  u32 round_resident, round_active;
+  u32 evicted, refaults;
 };
 
 void init_pgdir(struct pgdir *pgdir);
 WARN_RESULT PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
+WARN_RESULT PTEntriesPtr lookup_pte(struct pgdir *pgdir, u64 va);
+WARN_RESULT PTEntriesPtr lookup_block(struct pgdir *pgdir, u64 va);
+WARN_RESULT bool shared_pte(struct pgdir *pgdir, u64 va);
+// Write `entry` to `*pte` in a table of a page table. Entries that may become
+// or stop being empty must be written this way, so that the table keeps the
+// count and range of its entries in its struct page.
+void set_pte(PTEntriesPtr pte, PTEntry entry);
 void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
+void vmmap_range(struct pgdir *pd, u64 va, void *ka, u64 size, u64 flags);
+void vmunmap_range(struct pgdir *pd, u64 begin, u64 end,
+                   void (*release)(PTEntry));
+void vmprotect_range(struct pgdir *pd, u64 begin, u64 end, u64 set,
+                     u64 clear);
+void for_each_pte(struct pgdir *pd, u64 begin, u64 end,
+                  void (*fn)(PTEntriesPtr pte, u64 va, void *arg), void *arg);
+// Like for_each_pte, but only on the entries that are not empty, and on the
+// blocks, which come with `block` set. Tables are read as they are, shared or
+// not, and only their populated ranges are visited. An entry comes with
+// `shared` set when any table on the way to it is shared with a forked copy,
+// which then maps it too.
+void for_each_live_pte(struct pgdir *pd, u64 begin, u64 end,
+                       void (*fn)(PTEntriesPtr pte, u64 va, bool block,
+                                  bool shared, void *arg),
+                       void *arg);
+WARN_RESULT bool vmmap_block(struct pgdir *pd, u64 va, void *ka, u64 flags);
+WARN_RESULT bool split_blocks(struct pgdir *pd, u64 begin, u64 end);
 void free_pgdir(struct pgdir *pgdir);
+void cow_range(struct pgdir *pgdir, u64 begin, u64 end);
+WARN_RESULT bool copy_pgdir(struct pgdir *dst, struct pgdir *src);
 void attach_pgdir(struct pgdir *pgdir);
+void tlbi_range(struct pgdir *pgdir, u64 begin, u64 end);
+void tlbi_page(struct pgdir *pgdir, u64 va);
+void tlbi_pgdir(struct pgdir *pgdir);
+
+// blocks an unmap_batch holds before it flushes.
+#define UNMAP_BATCH_BLOCKS 4
+
+// Pages and blocks unmapped from `pd`, freed only once no TLB entry can reach
+// them. Start with `struct unmap_batch b = {.pd = pd};`, clear the entry
+// before adding what it mapped, and flush the TLB before unmap_batch_free. A
+// batch that fills up invalidates the ASID of `pd` before it frees anything.
+struct unmap_batch {
+  struct pgdir *pd;
+  struct page_batch pages;
+  int blocks;
+  void *block[UNMAP_BATCH_BLOCKS];
+};
+void unmap_batch_add(struct unmap_batch *b, void *page);
+void unmap_batch_add_block(struct unmap_batch *b, void *block);
+void unmap_batch_free(struct unmap_batch *b);
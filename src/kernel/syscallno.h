@@ -1,3 +1,8 @@
 #pragma once
 
-#define SYS_myreport 499
\ No newline at end of file
+#define SYS_myreport 499
+#define SYS_kmemstat 500
+#define SYS_fork 501
+#define SYS_faultaround 502
+#define SYS_swapra 503
+#define SYS_zswap 504
@@ -0,0 +1,287 @@
+extern "C" {
+#include <kernel/mem.h>
+}
+
+#include "mock/printk.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+extern "C" {
+extern __thread int mock_cpuid;
+u64 mock_timestamp();
+}
+
+namespace {
+
+// mem.c keeps per-CPU state for this many CPUs.
+constexpr int MAX_THREADS = 4;
+// like `alloc_test`: up to this many live objects per thread.
+constexpr int MAX_LIVE = 10000;
+constexpr int PAGE_BURST = 100;
+
+struct Options {
+    int threads = MAX_THREADS;
+    int ops = 1000000;
+    std::string workload = "mix";
+    unsigned seed = 1;
+    bool dump = false;
+};
+
+struct Object {
+    void* p;
+    int size;
+};
+
+struct Worker {
+    std::vector<u32> alloc_ns, free_ns;
+    std::vector<Object> live;
+    u64 live_bytes = 0;
+    u64 failures = 0;
+};
+
+std::atomic<int> ready;
+
+// the size mix of `alloc_test` in src/test/allocator.c.
+int object_size(std::mt19937& rng) {
+    int r = rng() & 255;
+    if (r < 127)
+        return (rng() % 48 + 17 + 3) / 4 * 4;
+    if (r < 181)
+        return rng() % 16 + 1;
+    if (r < 235)
+        return (rng() % 192 + 65 + 7) / 8 * 8;
+    if (r < 255)
+        return (rng() % 256 + 257 + 7) / 8 * 8;
+    return (rng() % 1528 + 513 + 7) / 8 * 8;
+}
+
+void check_object(Worker& w, const Object& o, int id) {
+    u8 m = (u8)(id ^ o.size);
+    for (int i = 0; i < o.size; i++) {
+        if (((u8*)o.p)[i] != m) {
+            fprintf(stderr, "(error) object %p of size %d is corrupted\n", o.p, o.size);
+            w.failures++;
+            return;
+        }
+    }
+}
+
+// kalloc/kfree with the alloc_test size mix. Objects are filled with a
+// pattern on allocation and checked before they are freed.
+void run_mix(Worker& w, int id, int ops, std::mt19937& rng) {
+    w.live.reserve(MAX_LIVE);
+    for (int i = 0; i < ops; i++) {
+        int n = (int)w.live.size();
+        if (n < MAX_LIVE && (n < 1000 || rng() % 16 >= 7)) {
+            int z = object_size(rng);
+            u64 t = mock_timestamp();
+            void* p = kalloc(z);
+            w.alloc_ns.push_back((u32)(mock_timestamp() - t));
+            if (p == nullptr || ((u64)p & (z % 8 == 0 ? 7 : z % 4 == 0 ? 3 : 0))) {
+                fprintf(stderr, "(error) kalloc(%d) = %p\n", z, p);
+                w.failures++;
+                continue;
+            }
+            memset(p, id ^ z, z);
+            w.live.push_back({p, z});
+            w.live_bytes += z;
+        } else {
+            int k = rng() % n;
+            Object o = w.live[k];
+            check_object(w, o, id);
+            u64 t = mock_timestamp();
+            kfree(o.p);
+            w.free_ns.push_back((u32)(mock_timestamp() - t));
+            w.live[k] = w.live.back();
+            w.live.pop_back();
+            w.live_bytes -= o.size;
+        }
+    }
+}
+
+// bursts of single pages, like `page_alloc_bench`.
+void run_page(Worker& w, int ops) {
+    void* pages[PAGE_BURST];
+    for (int i = 0; i < ops; i += 2 * PAGE_BURST) {
+        for (int j = 0; j < PAGE_BURST; j++) {
+            u64 t = mock_timestamp();
+            pages[j] = kalloc_page();
+            w.alloc_ns.push_back((u32)(mock_timestamp() - t));
+            if (pages[j] == nullptr) {
+                fprintf(stderr, "(error) kalloc_page() = NULL\n");
+                w.failures++;
+                return;
+            }
+            *(u64*)pages[j] = j;
+        }
+        for (int j = 0; j < PAGE_BURST; j++) {
+            if (*(u64*)pages[j] != (u64)j)
+                w.failures++;
+            u64 t = mock_timestamp();
+            kfree_page(pages[j]);
+            w.free_ns.push_back((u32)(mock_timestamp() - t));
+        }
+    }
+}
+
+void worker(const Options& opt, Worker& w, int id) {
+    mock_cpuid = id;
+    std::mt19937 rng(opt.seed * MAX_THREADS + id);
+    w.alloc_ns.reserve(opt.ops);
+    w.free_ns.reserve(opt.ops);
+    ready++;
+    while (ready.load() < opt.threads)
+        std::this_thread::yield();
+    if (opt.workload == "page")
+        run_page(w, opt.ops);
+    else
+        run_mix(w, id, opt.ops, rng);
+}
+
+void print_latency(const char* name, std::vector<u32>& ns) {
+    if (ns.empty())
+        return;
+    auto at = [&](double q) {
+        usize i = std::min((usize)ns.size() - 1, (usize)(q * ns.size()));
+        std::nth_element(ns.begin(), ns.begin() + i, ns.end());
+        return ns[i];
+    };
+    u32 p50 = at(0.5), p90 = at(0.9), p99 = at(0.99), p999 = at(0.999);
+    u32 max = *std::max_element(ns.begin(), ns.end());
+    printf("latency op=%s count=%zu p50_ns=%u p90_ns=%u p99_ns=%u p999_ns=%u max_ns=%u\n",
+           name,
+           ns.size(),
+           p50,
+           p90,
+           p99,
+           p999,
+           max);
+}
+
+// free pages of the buddy allocator, and how many of them are in blocks of
+// at least `order`, read from the kmem_stat_dump records.
+void buddy_free_pages(const std::string& dump, int order, u64* free, u64* usable) {
+    std::istringstream in(dump);
+    std::string line;
+    *free = *usable = 0;
+    while (std::getline(in, line)) {
+        int k;
+        unsigned long long blocks;
+        if (sscanf(line.c_str(), "buddy order=%d free_blocks=%llu", &k, &blocks) == 2) {
+            *free += blocks << k;
+            if (k >= order)
+                *usable += blocks << k;
+        }
+    }
+}
+
+// return the objects cached by every "CPU" so that all empty slabs can go
+// back to the page allocator.
+void drain_all() {
+    int saved = mock_cpuid;
+    for (int i = 0; i < MAX_THREADS; i++) {
+        mock_cpuid = i;
+        (void)shrink_memory(left_page_cnt() + alloc_page_cnt());
+    }
+    mock_cpuid = saved;
+}
+
+void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-t threads] [-n ops per thread] [-w mix|page] [-s seed] [-v]\n",
+            name);
+    exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    int c;
+    while ((c = getopt(argc, argv, "t:n:w:s:v")) != -1) {
+        switch (c) {
+            case 't': opt.threads = atoi(optarg); break;
+            case 'n': opt.ops = atoi(optarg); break;
+            case 'w': opt.workload = optarg; break;
+            case 's': opt.seed = (unsigned)atoi(optarg); break;
+            case 'v': opt.dump = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (opt.threads < 1 || opt.threads > MAX_THREADS || opt.ops < 1 ||
+        (opt.workload != "mix" && opt.workload != "page"))
+        usage(argv[0]);
+
+    isize base = alloc_page_cnt();
+    std::vector<Worker> workers(opt.threads);
+    std::vector<std::thread> threads;
+    u64 start = mock_timestamp();
+    for (int i = 0; i < opt.threads; i++)
+        threads.emplace_back(worker, std::cref(opt), std::ref(workers[i]), i);
+    for (auto& t : threads)
+        t.join();
+    u64 elapsed = mock_timestamp() - start;
+
+    u64 ops = 0, failures = 0, live_bytes = 0, live_objects = 0;
+    std::vector<u32> alloc_ns, free_ns;
+    for (auto& w : workers) {
+        ops += w.alloc_ns.size() + w.free_ns.size();
+        failures += w.failures;
+        live_bytes += w.live_bytes;
+        live_objects += w.live.size();
+        alloc_ns.insert(alloc_ns.end(), w.alloc_ns.begin(), w.alloc_ns.end());
+        free_ns.insert(free_ns.end(), w.free_ns.begin(), w.free_ns.end());
+    }
+    printf("bench workload=%s threads=%d ops=%llu seconds=%.3f ops_per_sec=%.0f\n",
+           opt.workload.c_str(),
+           opt.threads,
+           (unsigned long long)ops,
+           elapsed / 1e9,
+           ops / (elapsed / 1e9));
+    print_latency("alloc", alloc_ns);
+    print_latency("free", free_ns);
+
+    // fragmentation with the live set still allocated. `internal` is the part
+    // of the pages taken from the page allocator that holds no live bytes;
+    // `external_order9` is the part of the free pages that cannot back a 2MiB
+    // block.
+    std::string dump;
+    mock_printk_capture(&dump);
+    kmem_stat_dump();
+    mock_printk_capture(nullptr);
+    u64 used = alloc_page_cnt() - base, free, usable;
+    buddy_free_pages(dump, 9, &free, &usable);
+    printf("fragmentation live_objects=%llu live_bytes=%llu used_pages=%llu "
+           "internal=%.3f external_order9=%.3f\n",
+           (unsigned long long)live_objects,
+           (unsigned long long)live_bytes,
+           (unsigned long long)used,
+           used ? 1 - live_bytes / (used * 4096.0) : 0.0,
+           free ? 1 - (double)usable / free : 0.0);
+    if (opt.dump)
+        fputs(dump.c_str(), stdout);
+
+    for (auto& w : workers) {
+        u64 before = w.failures;
+        for (auto& o : w.live) {
+            check_object(w, o, (int)(&w - workers.data()));
+            kfree(o.p);
+        }
+        failures += w.failures - before;
+    }
+    drain_all();
+    isize leaked = alloc_page_cnt() - base;
+    printf("check failures=%llu leaked_pages=%lld\n", (unsigned long long)failures, (long long)leaked);
+    return failures || leaked ? 1 : 0;
+}
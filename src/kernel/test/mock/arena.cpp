@@ -0,0 +1,35 @@
+extern "C" {
+#include <common/defines.h>
+#include <driver/memlayout.h>
+}
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+extern "C" {
+char (*mock_kernel_end)[];
+}
+
+namespace {
+
+// the buddy allocator aligns its largest blocks (4MiB) to their size.
+constexpr usize ARENA_ALIGN = 4 << 20;
+
+// runs before the init hooks of mem.c, which are constructors with a larger
+// priority.
+__attribute__((constructor(101))) void map_arena() {
+    // one page in front of the arena plays the kernel image, like `end` on the
+    // board, followed by the page the allocator skips.
+    usize size = MOCK_ARENA_SIZE + 2 * ARENA_ALIGN;
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    usize base = ((usize)p + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    mock_kernel_end = (char(*)[])base;
+}
+
+}  // namespace
@@ -0,0 +1,17 @@
+extern "C" {
+#include <common/defines.h>
+}
+
+#include <time.h>
+
+extern "C" {
+
+// the "CPU" a thread runs on, set by the benchmark when it starts a thread.
+__thread int mock_cpuid;
+
+u64 mock_timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+}
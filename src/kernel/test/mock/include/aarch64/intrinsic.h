@@ -0,0 +1,54 @@
+#pragma once
+
+// host replacement of aarch64/intrinsic.h for the allocator benchmark.
+// every thread acts as one CPU, see `mock_set_cpuid`.
+
+#include <common/defines.h>
+#include <sched.h>
+
+extern __thread int mock_cpuid;
+u64 mock_timestamp();
+
+static WARN_RESULT ALWAYS_INLINE int cpuid() { return mock_cpuid; }
+
+static ALWAYS_INLINE void compiler_fence() { asm volatile("" ::: "memory"); }
+
+static WARN_RESULT ALWAYS_INLINE u64 get_clock_frequency() {
+  return 1000000000;
+}
+
+static WARN_RESULT ALWAYS_INLINE u64 get_timestamp() {
+  return mock_timestamp();
+}
+
+static ALWAYS_INLINE void arch_isb() { compiler_fence(); }
+
+static ALWAYS_INLINE void arch_dsb_sy() { __sync_synchronize(); }
+
+static ALWAYS_INLINE void arch_fence() { __sync_synchronize(); }
+
+static ALWAYS_INLINE void arch_tlbi_vmalle1is() {}
+
+static ALWAYS_INLINE void arch_set_ttbr0(u64 addr) { (void)addr; }
+
+static ALWAYS_INLINE void arch_sev() {}
+
+static ALWAYS_INLINE void arch_wfe() {}
+
+static ALWAYS_INLINE void arch_wfi() {}
+
+// there may be more threads than host cores, so spinning threads give up
+// their time slice.
+static ALWAYS_INLINE void arch_yield() { sched_yield(); }
+
+// a thread is never moved to another "CPU", so there is nothing to mask.
+static inline WARN_RESULT bool _arch_enable_trap() { return false; }
+
+static inline WARN_RESULT bool _arch_disable_trap() { return false; }
+
+#define arch_with_trap for (int __t_e = 1; __t_e; __t_e = 0)
+
+static ALWAYS_INLINE NO_RETURN void arch_stop_cpu() {
+  while (1)
+    sched_yield();
+}
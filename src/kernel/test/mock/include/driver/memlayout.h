@@ -0,0 +1,19 @@
+#pragma once
+
+// host replacement of driver/memlayout.h: the physical memory given to the
+// page allocator is an mmap'd arena, see `mock/arena.cpp`.
+
+#define MOCK_ARENA_SIZE (256ull << 20)
+
+#define EXTMEM 0x80000
+#define KSPACE_MASK 0xffff000000000000
+
+#define K2P_WO(x) ((x) - (KSPACE_MASK))
+#define P2K_WO(x) ((x) + (KSPACE_MASK))
+
+// mem.c places its memory after the linker symbol `end`, which it declares
+// after including this file. Turn that symbol into a pointer to the arena.
+extern char (*mock_kernel_end)[];
+#define end (*mock_kernel_end)
+
+#define PHYSTOP (K2P_WO((u64)mock_kernel_end) + MOCK_ARENA_SIZE)
@@ -0,0 +1,20 @@
+#pragma once
+
+// host replacement of kernel/init.h: init hooks become constructors, run in
+// the same order as on the board after the arena is mapped.
+
+#define define_early_init(name)                                                \
+  static void init_##name() __attribute__((constructor(102)));                 \
+  static void init_##name()
+
+#define define_init(name)                                                      \
+  static void init_##name() __attribute__((constructor(103)));                 \
+  static void init_##name()
+
+#define define_rest_init(name)                                                 \
+  static void init_##name() __attribute__((constructor(104)));                 \
+  static void init_##name()
+
+void do_early_init();
+void do_init();
+void do_rest_init();
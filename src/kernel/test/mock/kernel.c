@@ -0,0 +1,6 @@
+// symbols mem.c uses that live elsewhere in the kernel.
+
+#include <common/defines.h>
+#include <kernel/syscall.h>
+
+void *syscall_table[NR_SYSCALL];
@@ -0,0 +1,10 @@
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+void _panic(const char* file, int line) {
+    fflush(stdout);
+    fprintf(stderr, "(fatal) %s:L%d: kernel panic\n", file, line);
+    abort();
+}
+}
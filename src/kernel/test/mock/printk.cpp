@@ -0,0 +1,27 @@
+#include "printk.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+thread_local std::string* capture = nullptr;
+}
+
+void mock_printk_capture(std::string* buf) {
+    capture = buf;
+}
+
+extern "C" {
+
+void printk(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (capture) {
+        char line[512];
+        vsnprintf(line, sizeof(line), fmt, ap);
+        capture->append(line);
+    } else
+        vprintf(fmt, ap);
+    va_end(ap);
+}
+}
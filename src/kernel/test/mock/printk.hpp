@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+// redirect printk of the calling thread into `buf`. nullptr restores stdout.
+void mock_printk_capture(std::string* buf);
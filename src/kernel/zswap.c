@@ -0,0 +1,333 @@
+#include <common/list.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <fs/swap.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/syscall.h>
+#include <kernel/zswap.h>
+
+// The compressed pool keeps swapped out pages in memory, in front of the disk
+// swap area. Pages that are all zero keep nothing at all. Entries are on
+// `lru`, oldest first. When the pool is full the oldest are written back to
+// slots of their own, and stay as entries that only hold the slot, so the
+// page tables never change.
+struct zswap_entry {
+  ListNode lru;
+  u8 *data; // the compressed page, NULL once written back
+  u32 len;
+  u32 bno;   // its slot once written back
+  bool busy; // being written back
+  bool dead; // freed while busy
+};
+
+static SpinLock zswap_lock;
+static ListNode lru;
+static usize pool_bytes, pool_limit;
+static CacheNode *entry_cache;
+static struct {
+  u64 zero;      // pages that were all zero
+  u64 stored;    // pages compressed into the pool
+  u64 rejected;  // pages sent to disk instead
+  u64 loads;     // pages decompressed
+  u64 writeback; // pages written back to disk
+} zswap_stat;
+
+define_early_init(zswap_lock) {
+  init_spinlock(&zswap_lock);
+  init_list_node(&lru);
+}
+
+define_init(zswap) {
+  entry_cache = kmem_cache_create("zswap_entry", sizeof(struct zswap_entry),
+                                  8, NULL);
+  pool_limit = (alloc_page_cnt() + left_page_cnt()) * PAGE_SIZE *
+               ZSWAP_POOL_PERCENT / 100;
+}
+
+// A small LZ77 coder in the style of LZ4. The output is a run of sequences:
+// a token with the number of literals in its high nibble and the match length
+// less LZ_MIN_MATCH in its low one, a nibble of 15 going on in bytes of up to
+// 255 each; the literals; and a 2-byte offset back to the match. The last
+// sequence has literals only. Matches are found through a table of the last
+// position of each hash of 4 bytes.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+// compression scratch, under zswap_lock.
+static u16 lz_table[1 << LZ_HASH_BITS];
+static u8 lz_buf[ZSWAP_MAX_LEN];
+
+static u32 lz_read32(const u8 *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static u32 lz_hash(u32 v) { return (v * 2654435761u) >> (32 - LZ_HASH_BITS); }
+
+static u8 *lz_put_len(u8 *op, usize n) {
+  if (n < 15)
+    return op;
+  for (n -= 15; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = (u8)n;
+  return op;
+}
+
+// Append `lit` literals from `src`, then, unless `off` is 0, a match of
+// LZ_MIN_MATCH + `mlen` bytes `off` bytes back. Returns the new end of the
+// output, or NULL if it would pass `oend`.
+static u8 *lz_put_seq(u8 *op, u8 *oend, const u8 *src, usize lit, usize off,
+                      usize mlen) {
+  if (op + 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1 > oend)
+    return NULL;
+  u8 *token = op++;
+  *token = (u8)(MIN(lit, (usize)15) << 4);
+  op = lz_put_len(op, lit);
+  for (usize i = 0; i < lit; i++)
+    *op++ = src[i];
+  if (off == 0)
+    return op;
+  *op++ = (u8)off;
+  *op++ = (u8)(off >> 8);
+  *token |= (u8)MIN(mlen, (usize)15);
+  return lz_put_len(op, mlen);
+}
+
+// compress the `n` bytes at `src` into at most `cap` bytes at `dst`. Returns
+// the size, or 0 if it does not fit.
+static usize lz_compress(const u8 *src, usize n, u8 *dst, usize cap) {
+  const u8 *ip = src, *anchor = src, *end = src + n;
+  u8 *op = dst, *oend = dst + cap;
+  memset(lz_table, 0, sizeof(lz_table));
+  while (ip + LZ_MIN_MATCH < end) {
+    u32 h = lz_hash(lz_read32(ip));
+    const u8 *ref = src + lz_table[h];
+    lz_table[h] = (u16)(ip - src);
+    if (ref >= ip || lz_read32(ref) != lz_read32(ip)) {
+      ip++;
+      continue;
+    }
+    const u8 *m = ip + LZ_MIN_MATCH, *r = ref + LZ_MIN_MATCH;
+    while (m < end && *m == *r) {
+      m++;
+      r++;
+    }
+    op = lz_put_seq(op, oend, anchor, ip - anchor, ip - ref,
+                    m - ip - LZ_MIN_MATCH);
+    if (op == NULL)
+      return 0;
+    ip = anchor = m;
+  }
+  op = lz_put_seq(op, oend, anchor, end - anchor, 0, 0);
+  return op == NULL ? 0 : op - dst;
+}
+
+// read the rest of a length whose nibble was 15. Returns false at the end of
+// the input.
+static bool lz_get_len(const u8 **ip, const u8 *iend, usize *n) {
+  u8 b;
+  do {
+    if (*ip >= iend)
+      return false;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return true;
+}
+
+// decompress the `len` bytes at `src` into exactly `n` bytes at `dst`.
+// Returns whether the input was well formed.
+static bool lz_decompress(const u8 *src, usize len, u8 *dst, usize n) {
+  const u8 *ip = src, *iend = src + len;
+  u8 *op = dst, *oend = dst + n;
+  while (ip < iend) {
+    u8 token = *ip++;
+    usize lit = token >> 4;
+    if (lit == 15 && !lz_get_len(&ip, iend, &lit))
+      return false;
+    if (lit > (usize)(iend - ip) || lit > (usize)(oend - op))
+      return false;
+    for (usize i = 0; i < lit; i++)
+      *op++ = *ip++;
+    if (ip == iend)
+      break;
+    if (iend - ip < 2)
+      return false;
+    usize off = ip[0] | ip[1] << 8;
+    ip += 2;
+    usize mlen = token & 15;
+    if (mlen == 15 && !lz_get_len(&ip, iend, &mlen))
+      return false;
+    mlen += LZ_MIN_MATCH;
+    if (off == 0 || off > (usize)(op - dst) || mlen > (usize)(oend - op))
+      return false;
+    // the match may overlap what it writes.
+    for (usize i = 0; i < mlen; i++, op++)
+      *op = *(op - off);
+  }
+  return op == oend;
+}
+
+static bool page_is_zero(const void *page) {
+  const u64 *p = page;
+  for (usize i = 0; i < PAGE_SIZE / sizeof(u64); i++) {
+    if (p[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+static struct zswap_entry *entry_of(PTEntry pte) {
+  ASSERT(SWAP_TYPE(pte) == SWAP_ZPOOL);
+  return (struct zswap_entry *)P2K(pte & ~(u64)SWAP_ZPOOL);
+}
+
+// free `e` and what it keeps. zswap_lock must be held.
+static void release_entry(struct zswap_entry *e) {
+  if (e->data != NULL) {
+    _detach_from_list(&e->lru);
+    pool_bytes -= e->len;
+    kfree(e->data);
+  } else {
+    free_swap_slot(e->bno);
+  }
+  kmem_cache_free(entry_cache, e);
+}
+
+PTEntry zswap_store(const void *page) {
+  if (page_is_zero(page)) {
+    __atomic_fetch_add(&zswap_stat.zero, 1, __ATOMIC_RELAXED);
+    return SWAP_ZERO;
+  }
+  _acquire_spinlock(&zswap_lock);
+  struct zswap_entry *e = NULL;
+  u8 *data = NULL;
+  usize len = lz_compress(page, PAGE_SIZE, lz_buf, ZSWAP_MAX_LEN);
+  if (len > 0 && pool_bytes + len <= pool_limit) {
+    data = kalloc(len);
+    e = kmem_cache_alloc(entry_cache);
+  }
+  if (data == NULL || e == NULL) {
+    if (data != NULL)
+      kfree(data);
+    if (e != NULL)
+      kmem_cache_free(entry_cache, e);
+    zswap_stat.rejected++;
+    _release_spinlock(&zswap_lock);
+    return 0;
+  }
+  memcpy(data, lz_buf, len);
+  e->data = data;
+  e->len = (u32)len;
+  e->bno = 0;
+  e->busy = e->dead = false;
+  _insert_into_list(lru.prev, &e->lru);
+  pool_bytes += len;
+  zswap_stat.stored++;
+  _release_spinlock(&zswap_lock);
+  return K2P(e) | SWAP_ZPOOL;
+}
+
+void zswap_load(PTEntry pte, void *page) {
+  auto e = entry_of(pte);
+  _acquire_spinlock(&zswap_lock);
+  if (e->data == NULL || !lz_decompress(e->data, e->len, page, PAGE_SIZE)) {
+    printk("bad zswap entry\n");
+    PANIC();
+  }
+  zswap_stat.loads++;
+  _release_spinlock(&zswap_lock);
+}
+
+u32 zswap_slot(PTEntry pte) {
+  auto e = entry_of(pte);
+  return e->data == NULL ? e->bno : 0;
+}
+
+void zswap_free(PTEntry pte) {
+  if (SWAP_TYPE(pte) == SWAP_ZERO)
+    return;
+  auto e = entry_of(pte);
+  _acquire_spinlock(&zswap_lock);
+  if (e->busy)
+    e->dead = true;
+  else
+    release_entry(e);
+  _release_spinlock(&zswap_lock);
+}
+
+// pages being written back, under swap_lock.
+static u8 wb_buf[ZSWAP_WRITEBACK_BATCH][PAGE_SIZE]
+    __attribute__((aligned(PAGE_SIZE)));
+
+void zswap_reserve(int pages) {
+  while (1) {
+    struct zswap_entry *wb[ZSWAP_WRITEBACK_BATCH];
+    u32 bno[ZSWAP_WRITEBACK_BATCH];
+    u8 *buf[ZSWAP_WRITEBACK_BATCH];
+    int n = 0;
+    _acquire_spinlock(&zswap_lock);
+    while (n < ZSWAP_WRITEBACK_BATCH && !_empty_list(&lru) &&
+           pool_bytes + (usize)pages * ZSWAP_MAX_LEN > pool_limit) {
+      auto e = container_of(lru.next, struct zswap_entry, lru);
+      _detach_from_list(&e->lru);
+      pool_bytes -= e->len;
+      e->busy = true;
+      if (!lz_decompress(e->data, e->len, wb_buf[n], PAGE_SIZE)) {
+        printk("bad zswap entry\n");
+        PANIC();
+      }
+      wb[n++] = e;
+    }
+    _release_spinlock(&zswap_lock);
+    if (n == 0)
+      return;
+    for (int i = 0; i < n; i++) {
+      bno[i] = alloc_swap_slot();
+      buf[i] = wb_buf[i];
+    }
+    swap_write_pages(bno, buf, (usize)n);
+    _acquire_spinlock(&zswap_lock);
+    for (int i = 0; i < n; i++) {
+      auto e = wb[i];
+      kfree(e->data);
+      e->data = NULL;
+      e->bno = bno[i];
+      e->busy = false;
+      if (e->dead)
+        release_entry(e);
+    }
+    zswap_stat.writeback += (u64)n;
+    _release_spinlock(&zswap_lock);
+  }
+}
+
+usize zswap_set_limit(usize pages) {
+  _acquire_spinlock(&zswap_lock);
+  usize old = pool_limit / PAGE_SIZE;
+  pool_limit = pages * PAGE_SIZE;
+  _release_spinlock(&zswap_lock);
+  return old;
+}
+
+// Set the pool limit to `pages` pages if it is not negative, and print a
+// record like the ones of kmemstat:
+//   zswap limit= bytes= zero= stored= rejected= loads= writeback=
+// Returns the limit in use, in pages.
+define_syscall(zswap, i64 pages) {
+  if (pages >= 0) {
+    zswap_set_limit((usize)pages);
+  }
+  // a snapshot, so the record is consistent and printk is not under the lock.
+  _acquire_spinlock(&zswap_lock);
+  usize limit = pool_limit, bytes = pool_bytes;
+  auto stat = zswap_stat;
+  _release_spinlock(&zswap_lock);
+  stat.zero = __atomic_load_n(&zswap_stat.zero, __ATOMIC_RELAXED);
+  printk("zswap limit=%lld bytes=%lld zero=%llu stored=%llu rejected=%llu "
+         "loads=%llu writeback=%llu\n",
+         (i64)(limit / PAGE_SIZE), (i64)bytes, stat.zero, stat.stored,
+         stat.rejected, stat.loads, stat.writeback);
+  return limit / PAGE_SIZE;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <aarch64/mmu.h>
+#include <common/defines.h>
+
+// Swap entries are the invalid, non-empty entries of swapped out pages. Bits
+// 1 and 2 tell where the page went.
+#define SWAP_DISK 0         // bits 12.. are the first block of its slot
+#define SWAP_ZERO (1 << 1)  // it was all zero, and nothing is kept of it
+#define SWAP_ZPOOL (1 << 2) // the rest is the address of its pool entry
+#define SWAP_TYPE(pte) ((pte) & (SWAP_ZERO | SWAP_ZPOOL))
+
+// share of memory the compressed pool may take by default.
+#define ZSWAP_POOL_PERCENT 20
+// pages that do not compress to this or less go to disk.
+#define ZSWAP_MAX_LEN (PAGE_SIZE / 2)
+// pages written back to disk in one request when the pool is full.
+#define ZSWAP_WRITEBACK_BATCH 4
+
+// Keep `page` in memory. Returns its swap entry, or 0 if it is to go to
+// disk: it does not compress well, or the pool is full.
+PTEntry zswap_store(const void *page);
+
+// decompress the page of the SWAP_ZPOOL entry `pte` into `page`.
+void zswap_load(PTEntry pte, void *page);
+
+// the first block of the slot of the SWAP_ZPOOL entry `pte` if it was written
+// back to disk, or 0.
+u32 zswap_slot(PTEntry pte);
+
+// drop the SWAP_ZERO or SWAP_ZPOOL entry `pte` and what it keeps.
+void zswap_free(PTEntry pte);
+
+// Make room in the pool for `pages` more pages, writing the oldest back to
+// disk if it is full. Sleeps, and the caller holds swap_lock.
+void zswap_reserve(int pages);
+
+// set the pool limit to `pages` pages of compressed data. Returns the old one.
+usize zswap_set_limit(usize pages);
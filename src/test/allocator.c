@@ -5,8 +5,6 @@
 #include <kernel/printk.h>
 #include <test/test.h>
 
-extern RefCount alloc_page_cnt;
-
 static RefCount x;
 static void *p[4][10000];
 static short sz[4][10000];
@@ -26,7 +24,7 @@ static short sz[4][10000];
 
 void alloc_test() {
   int i = cpuid();
-  int r = alloc_page_cnt.count;
+  int r = alloc_page_cnt();
   int y = 10000 - i * 500;
   if (i == 0)
     printk("alloc_test\n");
@@ -45,8 +43,8 @@ void alloc_test() {
     kfree_page(p[i][j]);
   }
   SYNC(2)
-  if (alloc_page_cnt.count != r)
-    FAIL("FAIL: alloc_page_cnt %d -> %lld\n", r, alloc_page_cnt.count);
+  if (alloc_page_cnt() != r)
+    FAIL("FAIL: alloc_page_cnt %d -> %lld\n", r, alloc_page_cnt());
   SYNC(3)
   for (int j = 0; j < 10000;) {
     if (j < 1000 || rand() > RAND_MAX / 16 * 7) {
@@ -102,7 +100,7 @@ void alloc_test() {
     for (int j = 0; j < 4; j++)
       for (int k = 0; k < 10000; k++)
         z += sz[j][k];
-    printk("Total: %lld\nUsage: %lld\n", z, alloc_page_cnt.count - r);
+    printk("Total: %lld\nUsage: %lld\n", z, alloc_page_cnt() - r);
   }
   SYNC(5)
   for (int j = 0; j < 10000; j++)
@@ -111,3 +109,209 @@ void alloc_test() {
   if (cpuid() == 0)
     printk("alloc_test PASS\n");
 }
+
+#define PAGE_BENCH_ROUNDS 2000
+#define PAGE_BENCH_BURST 100
+
+static RefCount bench_x;
+static u64 bench_ticks[4];
+
+#define BENCH_SYNC(i)                                                          \
+  arch_dsb_sy();                                                               \
+  _increment_rc(&bench_x);                                                     \
+  while (bench_x.count < 4 * i)                                                \
+    ;                                                                          \
+  arch_dsb_sy();
+
+// every CPU allocates a burst of pages and frees them again, so the numbers
+// show how well kalloc_page/kfree_page scale across cores.
+void page_alloc_bench() {
+  int i = cpuid();
+  isize r = alloc_page_cnt();
+  if (i == 0)
+    printk("page_alloc_bench\n");
+  BENCH_SYNC(1)
+  u64 t0 = get_timestamp();
+  for (int k = 0; k < PAGE_BENCH_ROUNDS; k++) {
+    for (int j = 0; j < PAGE_BENCH_BURST; j++) {
+      p[i][j] = kalloc_page();
+      if (!p[i][j])
+        FAIL("FAIL: alloc_page() = %p\n", p[i][j]);
+    }
+    for (int j = 0; j < PAGE_BENCH_BURST; j++)
+      kfree_page(p[i][j]);
+  }
+  bench_ticks[i] = get_timestamp() - t0;
+  BENCH_SYNC(2)
+  if (i == 0) {
+    u64 freq = get_clock_frequency(), total = 0;
+    for (int j = 0; j < 4; j++) {
+      // one op is one kalloc_page plus one kfree_page
+      u64 ops = (u64)PAGE_BENCH_ROUNDS * PAGE_BENCH_BURST * freq /
+                MAX(bench_ticks[j], 1ull);
+      total += ops;
+      printk("CPU %d: %llu ops/s\n", j, ops);
+    }
+    printk("Total: %llu ops/s\n", total);
+    if (alloc_page_cnt() != r)
+      FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  }
+  BENCH_SYNC(3)
+  if (i == 0)
+    printk("page_alloc_bench PASS\n");
+}
+
+// single CPU: contiguous blocks are aligned to their size, do not overlap and
+// are merged again when freed.
+void buddy_test() {
+  static void *blk[11][8];
+  isize r = alloc_page_cnt();
+  printk("buddy_test\n");
+  for (int order = 0; order < 11; order++) {
+    for (int j = 0; j < 8; j++) {
+      blk[order][j] = kalloc_pages(order);
+      if (!blk[order][j] || (K2P(blk[order][j]) & ((PAGE_SIZE << order) - 1)))
+        FAIL("FAIL: kalloc_pages(%d) = %p\n", order, blk[order][j]);
+      memset(blk[order][j], order * 8 + j, PAGE_SIZE << order);
+    }
+  }
+  for (int order = 0; order < 11; order++) {
+    for (int j = 0; j < 8; j++) {
+      u8 m = order * 8 + j;
+      for (u64 k = 0; k < (u64)PAGE_SIZE << order; k += 512)
+        if (((u8 *)blk[order][j])[k] != m)
+          FAIL("FAIL: block[%d][%d] overlaps\n", order, j);
+      kfree_pages(blk[order][j], order);
+    }
+  }
+  if (alloc_page_cnt() != r)
+    FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  void *big = kalloc_pages(10);
+  if (!big)
+    FAIL("FAIL: free blocks were not merged\n");
+  kfree_pages(big, 10);
+  printk("buddy_test PASS\n");
+}
+
+// freed objects keep their slabs; the slab shrinker gives them back.
+void shrinker_test() {
+  static void *obj[4096];
+  isize r = alloc_page_cnt();
+  printk("shrinker_test\n");
+  for (int i = 0; i < 4096; i++) {
+    obj[i] = kalloc(64);
+    if (!obj[i])
+      FAIL("FAIL: kalloc(64) = NULL\n");
+  }
+  for (int i = 0; i < 4096; i++)
+    kfree(obj[i]);
+  if (alloc_page_cnt() <= r)
+    FAIL("FAIL: no slab was kept\n");
+  shrink_memory(alloc_page_cnt() - r);
+  if (alloc_page_cnt() > r)
+    FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  printk("shrinker_test PASS\n");
+}
+
+static void kmem_cache_test_ctor(void *p) { *(u64 *)p = 0x5a5a5a5a; }
+
+// objects are aligned and come back constructed.
+void kmem_cache_test() {
+  static void *obj[1024];
+  printk("kmem_cache_test\n");
+  auto cache = kmem_cache_create("test", 72, CACHE_LINE_SIZE,
+                                 kmem_cache_test_ctor);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 1024; i++) {
+      obj[i] = kmem_cache_alloc(cache);
+      if (!obj[i] || ((u64)obj[i] & (CACHE_LINE_SIZE - 1)))
+        FAIL("FAIL: kmem_cache_alloc = %p\n", obj[i]);
+      if (*(u64 *)obj[i] != 0x5a5a5a5a)
+        FAIL("FAIL: object %p is not constructed\n", obj[i]);
+    }
+    for (int i = 0; i < 1024; i++)
+      kmem_cache_free(cache, obj[i]);
+  }
+  printk("kmem_cache_test PASS\n");
+}
+
+// a shared page is freed with its last reference.
+void page_ref_test() {
+  isize r = alloc_page_cnt();
+  printk("page_ref_test\n");
+  void *p = kalloc_page();
+  for (int i = 0; i < 3; i++)
+    get_page(p);
+  for (int i = 0; i < 3; i++) {
+    kfree_page(p);
+    if (alloc_page_cnt() != r + 1 || page_ref_cnt(p) != 3 - i)
+      FAIL("FAIL: shared page freed early\n");
+  }
+  kfree_page(p);
+  if (alloc_page_cnt() != r)
+    FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  void *z = get_zero_page();
+  kfree_page(z);
+  if (!check_zero_page() || page_ref_cnt(z) < 1)
+    FAIL("FAIL: zero page freed\n");
+  printk("page_ref_test PASS\n");
+}
+
+void zero_pool_test() {
+  isize r = alloc_page_cnt();
+  printk("zero_pool_test\n");
+  void *p[8];
+  for (int i = 0; i < 8; i++) {
+    p[i] = kalloc_page();
+    memset(p[i], 0x5a, PAGE_SIZE);
+  }
+  for (int i = 0; i < 8; i++)
+    kfree_page(p[i]);
+  for (int i = 0; i < 8; i++)
+    zero_idle_page();
+  if (alloc_page_cnt() != r)
+    FAIL("FAIL: pool pages counted as allocated\n");
+  for (int i = 0; i < 8; i++) {
+    p[i] = kalloc_zeroed_page();
+    for (int j = 0; j < PAGE_SIZE; j++)
+      if (((u8 *)p[i])[j])
+        FAIL("FAIL: page %d not zeroed at %d\n", i, j);
+    if (page_ref_cnt(p[i]) != 1)
+      FAIL("FAIL: zeroed page ref %lld\n", page_ref_cnt(p[i]));
+  }
+  for (int i = 0; i < 8; i++)
+    kfree_page(p[i]);
+  if (alloc_page_cnt() != r)
+    FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  printk("zero_pool_test PASS\n");
+}
+
+void batch_test() {
+  isize r = alloc_page_cnt();
+  printk("batch_test\n");
+  static void *p[100];
+  for (int z = 8; z <= 4096; z *= 8) {
+    if (kalloc_batch(z, p, 100) != 100)
+      FAIL("FAIL: kalloc_batch(%d)\n", z);
+    for (int i = 0; i < 100; i++)
+      memset(p[i], i, z);
+    for (int i = 0; i < 100; i++)
+      for (int j = 0; j < z; j++)
+        if (((u8 *)p[i])[j] != (u8)i)
+          FAIL("FAIL: object %d of size %d overlaps\n", i, z);
+    kfree_batch(p, 100);
+  }
+  if (kalloc_page_batch(p, 100) != 100)
+    FAIL("FAIL: kalloc_page_batch\n");
+  if (alloc_page_cnt() != r + 100)
+    FAIL("FAIL: alloc_page_cnt %lld -> %lld\n", r, alloc_page_cnt());
+  get_page(p[0]);
+  struct page_batch b = {0};
+  for (int i = 0; i < 100; i++)
+    page_batch_add(&b, p[i]);
+  page_batch_flush(&b);
+  if (alloc_page_cnt() != r + 1 || page_ref_cnt(p[0]) != 1)
+    FAIL("FAIL: shared page freed by batch\n");
+  kfree_page(p[0]);
+  printk("batch_test PASS\n");
+}
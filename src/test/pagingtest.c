@@ -8,6 +8,7 @@
 #include <kernel/pt.h>
 #include <kernel/sched.h>
 #include <kernel/syscall.h>
+#include <kernel/zswap.h>
 #include <test/test.h>
 
 // only need the heap section
@@ -167,4 +168,459 @@ void pgfault_second_test() {
     PANIC();
 
   printk("pgfault_second_test PASS!\n");
-}
\ No newline at end of file
+}
+
+void cow_test() {
+  i64 limit = 10;
+  struct pgdir *pd = &thisproc()->pgdir;
+  attach_pgdir(pd);
+  static struct pgdir child;
+  printk("cow_test\n");
+  u64 begin = sbrk(limit);
+  for (i64 i = 0; i < limit; ++i)
+    *(i64 *)(begin + i * PAGE_SIZE) = i;
+  init_pgdir(&child);
+  u64 pc = left_page_cnt();
+  ASSERT(copy_pgdir(&child, pd));
+  // only the root table is new, the rest is shared.
+  ASSERT(left_page_cnt() + 1 >= pc);
+  for (i64 i = 0; i < limit; ++i)
+    ASSERT(*(i64 *)(begin + i * PAGE_SIZE) == i);
+  ASSERT(left_page_cnt() + 1 >= pc);
+
+  // writes split the pages, the child keeps the old contents.
+  for (i64 i = 0; i < limit; ++i)
+    *(i64 *)(begin + i * PAGE_SIZE) = -i;
+  for (i64 i = 0; i < limit; ++i) {
+    auto pte = lookup_pte(&child, begin + i * PAGE_SIZE);
+    ASSERT(pte != NULL && (*pte & PTE_RO));
+    auto page = (i64 *)P2K(PTE_ADDRESS(*pte));
+    ASSERT(*page == i && page_ref_cnt(page) == 1);
+  }
+  free_pgdir(&child);
+
+  // without other sharers, writes do not copy.
+  init_pgdir(&child);
+  ASSERT(copy_pgdir(&child, pd));
+  free_pgdir(&child);
+  pc = left_page_cnt();
+  for (i64 i = 0; i < limit; ++i)
+    *(i64 *)(begin + i * PAGE_SIZE) = i;
+  ASSERT(pc == left_page_cnt());
+  for (i64 i = 0; i < limit; ++i)
+    ASSERT(*(i64 *)(begin + i * PAGE_SIZE) == i);
+  sbrk(-limit);
+  printk("cow_test PASS\n");
+}
+
+void zero_fault_test() {
+  i64 limit = 10;
+  struct pgdir *pd = &thisproc()->pgdir;
+  attach_pgdir(pd);
+  printk("zero_fault_test\n");
+  u64 begin = sbrk(limit);
+  u64 pc = left_page_cnt();
+  // reads map the zero page.
+  for (i64 i = 0; i < limit; ++i)
+    ASSERT(*(i64 *)(begin + i * PAGE_SIZE) == 0);
+  ASSERT(pc == left_page_cnt());
+  // the first write takes a page.
+  for (i64 i = 0; i < limit; ++i)
+    *(i64 *)(begin + i * PAGE_SIZE) = i;
+  ASSERT(pc == left_page_cnt() + limit);
+  for (i64 i = 0; i < limit; ++i)
+    ASSERT(*(i64 *)(begin + i * PAGE_SIZE) == i);
+  sbrk(-limit);
+  if (!check_zero_page())
+    PANIC();
+  printk("zero_fault_test PASS\n");
+}
+
+void fault_around_test() {
+  i64 limit = 2 * FAULT_AROUND_PAGES;
+  u64 window = FAULT_AROUND_PAGES * PAGE_SIZE;
+  struct pgdir *pd = &thisproc()->pgdir;
+  attach_pgdir(pd);
+  printk("fault_around_test\n");
+  u64 begin = sbrk(limit);
+  u64 va = (begin + window - 1) / window * window;
+  u64 pc = left_page_cnt();
+  // one read fault maps the whole window to the zero page.
+  ASSERT(*(i64 *)va == 0);
+  for (u64 p = va; p < va + window; p += PAGE_SIZE) {
+    auto pte = lookup_pte(pd, p);
+    ASSERT(pte != NULL && (*pte & PTE_VALID) && (*pte & PTE_RO) &&
+           is_zero_page((void *)P2K(PTE_ADDRESS(*pte))));
+  }
+  ASSERT(pc == left_page_cnt());
+  // writing one of them copies only that page.
+  *(i64 *)(va + PAGE_SIZE) = 1;
+  ASSERT(pc == left_page_cnt() + 1);
+  ASSERT(is_zero_page((void *)P2K(PTE_ADDRESS(*lookup_pte(pd, va)))));
+  // a write fault on an untouched page maps only that page.
+  *(i64 *)(va + window) = 1;
+  auto pte = lookup_pte(pd, va + window + PAGE_SIZE);
+  ASSERT(pte == NULL || *pte == 0);
+  sbrk(-limit);
+  printk("fault_around_test PASS\n");
+}
+
+void huge_page_test() {
+  i64 limit = 2 << HUGE_PAGE_ORDER;
+  i64 n = 1 << HUGE_PAGE_ORDER;
+  struct pgdir *pd = &thisproc()->pgdir;
+  attach_pgdir(pd);
+  printk("huge_page_test\n");
+  u64 pc = left_page_cnt();
+  u64 begin = sbrk(limit);
+  u64 va = (begin + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  // a write fault in a free 2 MiB range maps all of it with a block.
+  *(i64 *)va = 0;
+  ASSERT(lookup_block(pd, va) != NULL);
+  for (i64 i = 0; i < n; ++i)
+    *(i64 *)(va + i * PAGE_SIZE) = i;
+  // shrinking into the block splits it.
+  u64 end = sbrk(0);
+  sbrk(-(i64)((end - (va + HUGE_PAGE_SIZE)) / PAGE_SIZE + 1));
+  ASSERT(lookup_block(pd, va) == NULL);
+  for (i64 i = 0; i < n - 1; ++i)
+    ASSERT(*(i64 *)(va + i * PAGE_SIZE) == i);
+  sbrk(-(i64)((sbrk(0) - begin) / PAGE_SIZE));
+  ASSERT(pc <= left_page_cnt() + 1);
+  printk("huge_page_test PASS\n");
+}
+
+void range_map_test() {
+  static struct pgdir pg;
+  u64 n = 16, va = HUGE_PAGE_SIZE - n / 2 * PAGE_SIZE; // across two tables
+  printk("range_map_test\n");
+  init_pgdir(&pg);
+  void *ka = kalloc_pages(4);
+  split_pages(ka, 4);
+  vmmap_range(&pg, va, ka, n * PAGE_SIZE, PTE_USER_DATA);
+  for (u64 i = 0; i < n; i++) {
+    auto pte = lookup_pte(&pg, va + i * PAGE_SIZE);
+    ASSERT(pte != NULL && PTE_ADDRESS(*pte) == K2P(ka) + i * PAGE_SIZE);
+  }
+  vmprotect_range(&pg, va, va + n * PAGE_SIZE, PTE_RO, 0);
+  for (u64 i = 0; i < n; i++)
+    ASSERT(*lookup_pte(&pg, va + i * PAGE_SIZE) & PTE_RO);
+  // a page shared for copy-on-write stays read-only, and swap entries are
+  // left alone.
+  get_page(ka);
+  auto last = lookup_pte(&pg, va + (n - 1) * PAGE_SIZE);
+  PTEntry entry = *last;
+  *last = SWAP_ZERO;
+  vmprotect_range(&pg, va, va + n * PAGE_SIZE, 0, PTE_RO);
+  ASSERT(*lookup_pte(&pg, va) & PTE_RO);
+  for (u64 i = 1; i < n - 1; i++)
+    ASSERT(!(*lookup_pte(&pg, va + i * PAGE_SIZE) & PTE_RO));
+  ASSERT(*last == SWAP_ZERO);
+  *last = entry;
+  kfree_page(ka);
+  isize cnt = alloc_page_cnt();
+  vmunmap_range(&pg, va, va + n * PAGE_SIZE, NULL);
+  for (u64 i = 0; i < n; i++)
+    ASSERT(*lookup_pte(&pg, va + i * PAGE_SIZE) == 0);
+  ASSERT(alloc_page_cnt() == cnt - (isize)n);
+  free_pgdir(&pg);
+  printk("range_map_test PASS\n");
+}
+
+
+void asid_test() {
+  static struct pgdir pg[2];
+  u64 va = 0x1000;
+  printk("asid_test\n");
+  i64 *page[2] = {kalloc_page(), kalloc_page()};
+  for (int i = 0; i < 2; i++) {
+    *page[i] = i;
+    init_pgdir(&pg[i]);
+    vmmap(&pg[i], va, page[i], PTE_USER_DATA);
+  }
+  // switching does not flush, the entries are told apart by ASID.
+  for (int i = 0; i < 8; i++) {
+    attach_pgdir(&pg[i % 2]);
+    ASSERT(*(i64 *)va == i % 2);
+  }
+  ASSERT((pg[0].asid & 0xFF) != (pg[1].asid & 0xFF));
+  // new tables use up the ASIDs and roll the generation over.
+  for (int i = 0; i < 600; i++) {
+    auto pd = &pg[i % 2];
+    free_pgdir(pd);
+    init_pgdir(pd);
+    vmmap(pd, va, page[i % 2], PTE_USER_DATA);
+    attach_pgdir(pd);
+    ASSERT(*(i64 *)va == i % 2);
+    attach_pgdir(&pg[(i + 1) % 2]);
+    ASSERT(*(i64 *)va == (i + 1) % 2);
+  }
+  attach_pgdir(&thisproc()->pgdir);
+  for (int i = 0; i < 2; i++) {
+    vmunmap_range(&pg[i], va, va + PAGE_SIZE, NULL);
+    free_pgdir(&pg[i]);
+  }
+  printk("asid_test PASS\n");
+}
+
+
+// Fill `page` with bytes that do not compress, and `v` in its first word, so
+// that it is swapped out to disk.
+static void fill_incompressible(i64 *page, i64 v) {
+  u64 x = 0x9E3779B97F4A7C15 ^ (u64)v;
+  for (u64 i = 0; i < PAGE_SIZE / sizeof(i64); i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    page[i] = (i64)x;
+  }
+  page[0] = v;
+}
+
+static void clock_child(u64 n) {
+  struct pgdir *pd = &thisproc()->pgdir;
+  u64 w = SWAP_READAHEAD_PAGES;
+  for (u64 i = 0; i < n; i++) {
+    ASSERT(*(i64 *)(i * PAGE_SIZE) == (i64)i);
+    // the rest of its readahead window comes back with it.
+    for (u64 j = i - i % w; j < MIN(i - i % w + w, n); j++)
+      ASSERT(*lookup_pte(pd, j * PAGE_SIZE) & PTE_VALID);
+  }
+  exit(0);
+}
+
+void clock_test() {
+  u64 n = 16;
+  printk("clock_test\n");
+  auto p = create_proc();
+  struct pgdir *pd = &p->pgdir;
+  pd->heap->end = n * PAGE_SIZE;
+  for (u64 i = 0; i < n; i++) {
+    i64 *page = kalloc_page();
+    fill_incompressible(page, i);
+    vmmap(pd, i * PAGE_SIZE, page, PTE_USER_DATA);
+  }
+  // the hand clears every access flag on its first pass, and takes the first
+  // half on its second.
+  ASSERT(clock_reclaim(n / 2) == (int)n / 2);
+  for (u64 i = 0; i < n; i++) {
+    auto pte = *lookup_pte(pd, i * PAGE_SIZE);
+    ASSERT(i < n / 2 ? !(pte & PTE_VALID) : !(pte & AF_USED));
+  }
+  // pages that are accessed again get a second chance.
+  for (u64 i = n / 2; i < n * 3 / 4; i++)
+    *lookup_pte(pd, i * PAGE_SIZE) |= AF_USED;
+  ASSERT(clock_reclaim(n / 4) == (int)n / 4);
+  for (u64 i = n / 2; i < n; i++)
+    ASSERT((*lookup_pte(pd, i * PAGE_SIZE) & PTE_VALID) == (i < n * 3 / 4));
+  set_parent_to_this(p);
+  start_proc(p, clock_child, n);
+  int code, pid;
+  ASSERT(wait(&code, &pid) != -1 && code == 0);
+  printk("clock_test PASS\n");
+}
+
+static void clock_block_child(u64 n) {
+  for (u64 i = 0; i < n; i++)
+    ASSERT(*(i64 *)(i * PAGE_SIZE) == 0);
+  exit(0);
+}
+
+void clock_block_test() {
+  u64 n = 16;
+  printk("clock_block_test\n");
+  auto p = create_proc();
+  struct pgdir *pd = &p->pgdir;
+  pd->heap->end = HUGE_PAGE_SIZE;
+  void *block = kalloc_pages(HUGE_PAGE_ORDER);
+  memset(block, 0, HUGE_PAGE_SIZE);
+  ASSERT(vmmap_block(pd, 0, block, PTE_USER_BLOCK | PTE_RW));
+  // the hand splits the block, and its pages are reclaimed like any others.
+  ASSERT(clock_reclaim(n) == (int)n);
+  ASSERT(lookup_block(pd, 0) == NULL);
+  for (u64 i = 0; i < n; i++)
+    ASSERT(*lookup_pte(pd, i * PAGE_SIZE) == SWAP_ZERO);
+  set_parent_to_this(p);
+  start_proc(p, clock_block_child, n);
+  int code, pid;
+  ASSERT(wait(&code, &pid) != -1 && code == 0);
+  printk("clock_block_test PASS\n");
+}
+
+void reclaim_victim_test() {
+  u64 n = 16;
+  printk("reclaim_victim_test\n");
+  struct proc *p[2];
+  for (int k = 0; k < 2; k++) {
+    p[k] = create_proc();
+    struct pgdir *pd = &p[k]->pgdir;
+    pd->heap->end = n * PAGE_SIZE;
+    for (u64 i = 0; i < n; i++) {
+      i64 *page = kalloc_page();
+      fill_incompressible(page, i);
+      vmmap(pd, i * PAGE_SIZE, page, PTE_USER_DATA);
+    }
+  }
+  // one that just ran and faulted back what was taken from it is passed over
+  // while the other has pages to give.
+  for (int k = 0; k < 2; k++) {
+    struct pgdir *busy = &p[k]->pgdir, *idle = &p[1 - k]->pgdir;
+    busy->last_run = get_timestamp();
+    busy->evicted = busy->refaults = n;
+    idle->refaults = 0;
+    ASSERT(clock_reclaim(n / 2) == (int)n / 2);
+    for (u64 i = 0; i < n; i++) {
+      // what was taken from it on the first turn is still out.
+      ASSERT(!(*lookup_pte(busy, i * PAGE_SIZE) & PTE_VALID) ==
+             (k == 1 && i < n / 2));
+      ASSERT(!(*lookup_pte(idle, i * PAGE_SIZE) & PTE_VALID) == (i < n / 2));
+    }
+  }
+  for (int k = 0; k < 2; k++) {
+    set_parent_to_this(p[k]);
+    start_proc(p[k], clock_child, n);
+  }
+  for (int k = 0; k < 2; k++) {
+    int code, pid;
+    ASSERT(wait(&code, &pid) != -1 && code == 0);
+  }
+  printk("reclaim_victim_test PASS\n");
+}
+
+static void swap_readahead_child(u64 n) {
+  struct pgdir *pd = &thisproc()->pgdir;
+  u64 w = SWAP_READAHEAD_PAGES;
+  // one fault reads its window, and the neighbours are mapped cold.
+  ASSERT(*(i64 *)PAGE_SIZE == 1);
+  for (u64 i = 0; i < n; i++) {
+    auto pte = *lookup_pte(pd, i * PAGE_SIZE);
+    if (i >= w)
+      ASSERT(!(pte & PTE_VALID));
+    else if (i == 1)
+      ASSERT((pte & AF_USED) && !(pte & PTE_SWAP_RA));
+    else
+      ASSERT((pte & PTE_VALID) && (pte & PTE_SWAP_RA) && !(pte & AF_USED));
+  }
+  // touching one of them is a hit, and it is warm from then on.
+  ASSERT(*(i64 *)0 == 0);
+  auto pte = *lookup_pte(pd, 0);
+  ASSERT((pte & AF_USED) && !(pte & PTE_SWAP_RA));
+  exit(0);
+}
+
+void swap_readahead_test() {
+  u64 n = 2 * SWAP_READAHEAD_PAGES;
+  printk("swap_readahead_test\n");
+  auto p = create_proc();
+  struct pgdir *pd = &p->pgdir;
+  pd->heap->end = n * PAGE_SIZE;
+  for (u64 i = 0; i < n; i++) {
+    i64 *page = kalloc_page();
+    fill_incompressible(page, i);
+    vmmap(pd, i * PAGE_SIZE, page, PTE_USER_DATA);
+  }
+  ASSERT(clock_reclaim(n) == (int)n);
+  for (u64 i = 0; i < n; i++)
+    ASSERT(!(*lookup_pte(pd, i * PAGE_SIZE) & PTE_VALID));
+  set_parent_to_this(p);
+  start_proc(p, swap_readahead_child, n);
+  int code, pid;
+  ASSERT(wait(&code, &pid) != -1 && code == 0);
+  printk("swap_readahead_test PASS\n");
+}
+
+static void zswap_child(u64 n) {
+  for (u64 i = 0; i < n; i++) {
+    i64 *page = (i64 *)(i * PAGE_SIZE);
+    for (u64 j = 0; j < PAGE_SIZE / sizeof(i64); j++)
+      ASSERT(page[j] == (i % 2 == 0 ? 0 : (i64)(i + j / 64)));
+  }
+  exit(0);
+}
+
+void zswap_test() {
+  u64 n = 8;
+  printk("zswap_test\n");
+  auto p = create_proc();
+  struct pgdir *pd = &p->pgdir;
+  pd->heap->end = n * PAGE_SIZE;
+  // even pages are all zero, and odd ones compress well.
+  for (u64 i = 0; i < n; i++) {
+    i64 *page = kalloc_zeroed_page();
+    for (u64 j = 0; i % 2 == 1 && j < PAGE_SIZE / sizeof(i64); j++)
+      page[j] = (i64)(i + j / 64);
+    vmmap(pd, i * PAGE_SIZE, page, PTE_USER_DATA);
+  }
+  ASSERT(clock_reclaim(n) == (int)n);
+  for (u64 i = 0; i < n; i++) {
+    auto pte = *lookup_pte(pd, i * PAGE_SIZE);
+    ASSERT(i % 2 == 0 ? pte == SWAP_ZERO
+                      : SWAP_TYPE(pte) == SWAP_ZPOOL && zswap_slot(pte) == 0);
+  }
+  // a full pool writes the compressed pages back to disk.
+  usize limit = zswap_set_limit(0);
+  clock_reclaim(1);
+  zswap_set_limit(limit);
+  for (u64 i = 1; i < n; i += 2)
+    ASSERT(zswap_slot(*lookup_pte(pd, i * PAGE_SIZE)) != 0);
+  set_parent_to_this(p);
+  start_proc(p, zswap_child, n);
+  int code, pid;
+  ASSERT(wait(&code, &pid) != -1 && code == 0);
+  printk("zswap_test PASS\n");
+}
+
+void sparse_teardown_test() {
+  printk("sparse_teardown_test\n");
+  struct pgdir pd;
+  init_pgdir(&pd);
+  u64 va[] = {3 * PAGE_SIZE, 100 * PAGE_SIZE, 300 * HUGE_PAGE_SIZE};
+  void *page[3];
+  pd.heap->end = va[2] + PAGE_SIZE;
+  for (int i = 0; i < 3; i++) {
+    page[i] = kalloc_page();
+    get_page(page[i]);
+    vmmap(&pd, va[i], page[i], PTE_USER_DATA);
+  }
+  // a leaf table knows how many of its entries are used, and where.
+  auto meta = virt_to_page((void *)PAGE_BASE((u64)lookup_pte(&pd, va[0])));
+  ASSERT(meta->pte_cnt == 2 && meta->pte_lo == 3 && meta->pte_hi == 101);
+  vmunmap_range(&pd, va[1], va[1] + PAGE_SIZE, NULL);
+  ASSERT(meta->pte_cnt == 1 && page_ref_cnt(page[1]) == 1);
+  vmunmap_range(&pd, va[0], va[0] + PAGE_SIZE, NULL);
+  ASSERT(meta->pte_cnt == 0 && meta->pte_hi == 0);
+  // teardown still finds the page that is left.
+  free_pgdir(&pd);
+  for (int i = 0; i < 3; i++) {
+    ASSERT(page_ref_cnt(page[i]) == 1);
+    kfree_page(page[i]);
+  }
+  printk("sparse_teardown_test PASS\n");
+}
+
+void fork_teardown_test() {
+  i64 limit = 10;
+  struct pgdir *pd = &thisproc()->pgdir;
+  attach_pgdir(pd);
+  static struct pgdir child;
+  printk("fork_teardown_test\n");
+  u64 begin = sbrk(limit);
+  for (i64 i = 0; i < limit; ++i)
+    *(i64 *)(begin + i * PAGE_SIZE) = i;
+  init_pgdir(&child);
+  ASSERT(copy_pgdir(&child, pd));
+  // only the level-1 tables take a reference, so the leaf table is shared
+  // through the one above it.
+  auto pte = lookup_pte(pd, begin);
+  ASSERT(page_ref_cnt((void *)PAGE_BASE((u64)pte)) == 1);
+  // the child exits first, and leaves the pages to the parent.
+  free_pgdir(&child);
+  for (i64 i = 0; i < limit; ++i) {
+    pte = lookup_pte(pd, begin + i * PAGE_SIZE);
+    ASSERT(pte != NULL && (*pte & PTE_VALID));
+    ASSERT(page_ref_cnt((void *)P2K(PTE_ADDRESS(*pte))) == 1);
+    ASSERT(*(i64 *)(begin + i * PAGE_SIZE) == i);
+  }
+  sbrk(-limit);
+  printk("fork_teardown_test PASS\n");
+}
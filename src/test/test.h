@@ -4,6 +4,13 @@
 
 void proc_test();
 void alloc_test();
+void page_alloc_bench();
+void buddy_test();
+void shrinker_test();
+void kmem_cache_test();
+void page_ref_test();
+void zero_pool_test();
+void batch_test();
 void rbtree_test();
 void proc_test();
 void ipc_test();
@@ -12,5 +19,18 @@ void container_test();
 void user_proc_test();
 void pgfault_first_test();
 void pgfault_second_test();
+void cow_test();
+void zero_fault_test();
+void fault_around_test();
+void huge_page_test();
+void range_map_test();
+void asid_test();
+void clock_test();
+void clock_block_test();
+void reclaim_victim_test();
+void swap_readahead_test();
+void zswap_test();
+void sparse_teardown_test();
+void fork_teardown_test();
 // unsigned rand();
 void srand(unsigned seed);
\ No newline at end of file
@@ -15,13 +15,12 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
 void vm_test() {
   printk("vm_test\n");
   static void *p[100000];
-  extern RefCount alloc_page_cnt;
   struct pgdir pg;
-  int p0 = alloc_page_cnt.count;
+  int p0 = alloc_page_cnt();
   init_pgdir(&pg);
   for (u64 i = 0; i < 100000; i++) {
     p[i] = kalloc_page();
-    *get_pte(&pg, i << 12, true) = K2P(p[i]) | PTE_USER_DATA;
+    vmmap(&pg, i << 12, p[i], PTE_USER_DATA);
     *(int *)p[i] = i;
   }
   attach_pgdir(&pg);
@@ -33,7 +32,7 @@ void vm_test() {
   attach_pgdir(&pg);
   for (u64 i = 0; i < 100000; i++)
     kfree_page(p[i]);
-  ASSERT(alloc_page_cnt.count == p0);
+  ASSERT(alloc_page_cnt() == p0);
   printk("vm_test PASS\n");
 }
 
@@ -66,8 +65,8 @@ define_syscall(myreport, u64 id) {
 static void _create_user_proc(int i) {
   auto p = create_proc();
   for (u64 q = (u64)loop_start; q < (u64)loop_end; q += PAGE_SIZE) {
-    *get_pte(&p->pgdir, 0x400000 + q - (u64)loop_start, true) =
-        K2P(q) | PTE_USER_DATA;
+    vmmap(&p->pgdir, 0x400000 + q - (u64)loop_start, (void *)q,
+          PTE_USER_DATA);
   }
   ASSERT(p->pgdir.pt);
   p->ucontext->x[0] = i;
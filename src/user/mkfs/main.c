@@ -112,15 +112,18 @@ int main(int argc, char *argv[]) {
     sb.log_start = xint(2);
     sb.inode_start = xint(2 + num_log_blocks);
     sb.bitmap_start = xint(2 + num_log_blocks + ninodeblocks);
+    sb.swap_start = xint(FSSIZE);
+    sb.num_swap_blocks = xint(SWAPSIZE);
 
     printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d "
-           "total %d\n",
+           "total %d swap blocks %d\n",
            nmeta,
            num_log_blocks,
            ninodeblocks,
            nbitmap,
            num_data_blocks,
-           FSSIZE);
+           FSSIZE,
+           SWAPSIZE);
 
     freeblock = nmeta;  // the first free block that we can allocate
 